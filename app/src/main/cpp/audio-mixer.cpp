@@ -0,0 +1,352 @@
+//
+// Mixer of the player streams
+//
+
+#include <sched.h>
+#include <string.h>
+#include "audio-mixer.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXER_SSE2 1
+#endif
+
+
+static inline short sat16(int v) {
+    return (short) (v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+}
+
+
+/*
+ * out += in over samples samples, saturating. The vector paths use the
+ * saturating 16 bit adds, so they give the same result as sat16.
+ */
+void mix_add(short *out, const short *in, int samples) {
+    int i = 0;
+
+#if defined(MIXER_NEON)
+    for (; i + 8 <= samples; i += 8)
+        vst1q_s16(out + i, vqaddq_s16(vld1q_s16(out + i), vld1q_s16(in + i)));
+#elif defined(MIXER_SSE2)
+    for (; i + 8 <= samples; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (out + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_adds_epi16(a, b));
+    }
+#endif
+
+    for (; i < samples; i++)
+        out[i] = sat16(out[i] + in[i]);
+}
+
+
+// mono in, added to both channels of out
+static void mix_add_mono(short *out, const short *in, int frames) {
+    int i;
+
+    for (i = 0; i < frames; i++) {
+        out[2 * i] = sat16(out[2 * i] + in[i]);
+        out[2 * i + 1] = sat16(out[2 * i + 1] + in[i]);
+    }
+}
+
+
+// m may come from calloc: everything is set here
+void mixer_init(audio_mixer_t *m, int frames) {
+    int i;
+
+    for (i = 0; i < MIXER_MAX_INPUTS; i++)
+        m->inputs[i].state.store(MIXER_INPUT_FREE);
+    m->running.store(0);
+    m->frames = frames;
+}
+
+
+/*
+ * Take a free input for a stream of channels channels (1 or
+ * MIXER_CHANNELS) enqueueing buffers of frames frames, and keeping up to
+ * depth frames queued; done(context) is called as each of them has been
+ * mixed. Underruns are counted in stats, which may be NULL.
+ * Returns NULL if all the inputs are taken.
+ */
+mixer_input_t *mixer_add_input(audio_mixer_t *m, int channels, int frames, int depth,
+                               mixer_done_callback done, void *context, mixer_stats_t *stats) {
+    mixer_input_t *in;
+    int i, expected;
+
+    if (channels != 1 && channels != MIXER_CHANNELS)
+        return NULL;
+
+    for (i = 0; i < MIXER_MAX_INPUTS; i++) {
+        in = &m->inputs[i];
+        expected = MIXER_INPUT_FREE;
+        if (in->state.compare_exchange_strong(expected, MIXER_INPUT_CLAIMED))
+            break;
+    }
+    if (i == MIXER_MAX_INPUTS)
+        return NULL;
+
+    in->channels = channels;
+    in->frames = frames;
+    in->depth = depth;
+    in->done = done;
+    in->context = context;
+    in->stats = stats;
+    in->queue.head.store(0);
+    in->queue.tail.store(0);
+    in->current = NULL;
+    in->offset = 0;
+
+    in->started = 0;
+    in->concealed = 0;
+    in->realign = 0;
+    in->xfade_frames = in->xfade_pos = 0;
+    memset(in->hist, 0, sizeof(in->hist));
+
+    in->state.store(MIXER_INPUT_LIVE);
+    return in;
+}
+
+
+/*
+ * Stop mixing in, waiting for a mixer_run in progress to be done with
+ * it. Buffers still enqueued are dropped without a done callback.
+ */
+void mixer_remove_input(audio_mixer_t *m, mixer_input_t *in) {
+    if (in == NULL)
+        return;
+
+    in->state.store(MIXER_INPUT_CLAIMED);
+    while (m->running.load())
+        sched_yield();
+    in->state.store(MIXER_INPUT_FREE);
+}
+
+
+// hand a full buffer to the mixer; returns -1 if the queue is full
+int mixer_enqueue(mixer_input_t *in, const short *buffer) {
+    return in->queue.push(buffer) ? 0 : -1;
+}
+
+
+// add n frames of src, in the layout of the input, to out
+static void mix_input(mixer_input_t *in, short *out, const short *src, int n) {
+    if (in->channels == MIXER_CHANNELS)
+        mix_add(out, src, n * MIXER_CHANNELS);
+    else
+        mix_add_mono(out, src, n);
+}
+
+
+// keep the last frames mixed, which the concealment repeats
+static void hist_push(mixer_input_t *in, const short *src, int n) {
+    int ch = in->channels;
+
+    if (n >= CONCEAL_FRAMES) {
+        memcpy(in->hist, src + (n - CONCEAL_FRAMES) * ch, CONCEAL_FRAMES * ch * sizeof(short));
+        return;
+    }
+    memmove(in->hist, in->hist + n * ch, (size_t) (CONCEAL_FRAMES - n) * ch * sizeof(short));
+    memcpy(in->hist + (CONCEAL_FRAMES - n) * ch, src, (size_t) n * ch * sizeof(short));
+}
+
+
+/*
+ * Make up the next n frames of the current dropout: the history past its
+ * first CONCEAL_FADE frames, repeated, the end of each repeat crossfaded
+ * into the frames that precede its start. The first frames crossfade
+ * from the last real one, and the whole fades out to silence over
+ * CONCEAL_MAX_FRAMES.
+ */
+static void conceal(mixer_input_t *in, short *out, int n) {
+    const int period = CONCEAL_FRAMES - CONCEAL_FADE;
+    const short *last = in->hist + (CONCEAL_FRAMES - 1) * in->channels;
+    int ch = in->channels, i, c, d, phase;
+    float g, w, v;
+
+    for (i = 0; i < n; i++) {
+        d = in->concealed + i;
+        if (d >= CONCEAL_MAX_FRAMES) {
+            memset(out + i * ch, 0, (size_t) (n - i) * ch * sizeof(short));
+            break;
+        }
+
+        g = 1.f - (float) d / CONCEAL_MAX_FRAMES;
+        phase = d % period;
+
+        for (c = 0; c < ch; c++) {
+            v = in->hist[(CONCEAL_FADE + phase) * ch + c];
+            if (phase >= period - CONCEAL_FADE) {
+                w = (float) (phase - (period - CONCEAL_FADE) + 1) / (CONCEAL_FADE + 1);
+                v += w * (in->hist[(phase - (period - CONCEAL_FADE)) * ch + c] - v);
+            }
+            if (d < CONCEAL_FADE) {
+                w = (float) (d + 1) / (CONCEAL_FADE + 1);
+                v = last[c] + w * (v - last[c]);
+            }
+            out[i * ch + c] = (short) (g * v);
+        }
+    }
+    in->concealed += n;
+}
+
+
+// the buffer being consumed is done: hand it back
+static void finish_buffer(mixer_input_t *in) {
+    in->current = NULL;
+    in->offset = 0;
+    in->done(in->context);
+}
+
+
+/*
+ * Drop up to in->realign frames of late data, as far as more than the
+ * depth of the stream, and at least need frames, are queued. Once the
+ * queue is back to its depth there is nothing left to realign. Unless a
+ * transition is under way already, the first dropped frames are kept
+ * aside to crossfade into the frames that follow them.
+ */
+static void realign(mixer_input_t *in, int need) {
+    int ch = in->channels, avail, skip, k;
+
+    avail = in->frames - in->offset +
+            (int) (in->queue.tail.load(std::memory_order_acquire) -
+                   in->queue.head.load(std::memory_order_relaxed)) * in->frames;
+    skip = avail - (in->depth > need ? in->depth : need);
+    if (skip <= 0) {
+        in->realign = 0;
+        return;
+    }
+    if (skip > in->realign) skip = in->realign;
+
+    if (in->xfade_pos == in->xfade_frames) {
+        k = in->frames - in->offset;
+        if (k > skip) k = skip;
+        if (k > CONCEAL_FADE) k = CONCEAL_FADE;
+        memcpy(in->xfade, in->current + in->offset * ch, (size_t) k * ch * sizeof(short));
+        in->xfade_frames = k;
+        in->xfade_pos = 0;
+    }
+
+    in->realign -= skip;
+    if (in->stats)
+        in->stats->realigned.fetch_add((uint32_t) skip, std::memory_order_relaxed);
+
+    while (skip > 0) {
+        if (in->current == NULL)
+            in->queue.pop(in->current);
+        k = in->frames - in->offset;
+        if (k > skip) k = skip;
+        in->offset += k;
+        skip -= k;
+        if (in->offset == in->frames)
+            finish_buffer(in);
+    }
+}
+
+
+/*
+ * Mix the next n frames of the buffer being consumed into out, the first
+ * ones crossfaded from the outgoing side of a transition if there is one.
+ */
+static void mix_data(mixer_input_t *in, short *out, int n) {
+    short blend[CONCEAL_FADE * MIXER_CHANNELS];
+    const short *src = in->current + in->offset * in->channels;
+    int ch = in->channels, i, k = 0;
+    float w;
+
+    if (in->xfade_pos < in->xfade_frames) {
+        k = in->xfade_frames - in->xfade_pos;
+        if (k > n) k = n;
+        for (i = 0; i < k * ch; i++) {
+            w = (float) (in->xfade_pos + i / ch + 1) / (in->xfade_frames + 1);
+            blend[i] = (short) (in->xfade[in->xfade_pos * ch + i] +
+                                w * (src[i] - in->xfade[in->xfade_pos * ch + i]));
+        }
+        in->xfade_pos += k;
+        mix_input(in, out, blend, k);
+        hist_push(in, blend, k);
+    }
+
+    mix_input(in, out + k * MIXER_CHANNELS, src + k * ch, n - k);
+    hist_push(in, src + k * ch, n - k);
+    in->offset += n;
+}
+
+
+/*
+ * Mix one period of every live input into out (m->frames frames of
+ * MIXER_CHANNELS channels). Called from the engine player callback.
+ */
+void mixer_run(audio_mixer_t *m, short *out) {
+    short made_up[CONCEAL_FADE * MIXER_CHANNELS];
+    mixer_input_t *in;
+    int i, n, k, mixed;
+
+    memset(out, 0, (size_t) m->frames * MIXER_CHANNELS * sizeof(short));
+
+    // paired with mixer_remove_input: either it sees running, or we see
+    // the input is no longer live
+    m->running.store(1);
+
+    for (i = 0; i < MIXER_MAX_INPUTS; i++) {
+        in = &m->inputs[i];
+        if (in->state.load() != MIXER_INPUT_LIVE)
+            continue;
+
+        for (mixed = 0; mixed < m->frames; mixed += n) {
+            if (in->current == NULL && !in->queue.pop(in->current)) {
+                // underrun, unless the stream has not started yet
+                n = m->frames - mixed;
+                if (!in->started)
+                    break;
+
+                if (in->stats) {
+                    if (in->concealed == 0)
+                        in->stats->underruns.fetch_add(1, std::memory_order_relaxed);
+                    in->stats->concealed.fetch_add((uint32_t) n, std::memory_order_relaxed);
+                }
+                in->xfade_pos = in->xfade_frames;
+
+                for (; mixed < m->frames; mixed += k) {
+                    k = m->frames - mixed;
+                    if (k > CONCEAL_FADE) k = CONCEAL_FADE;
+                    conceal(in, made_up, k);
+                    mix_input(in, out + mixed * MIXER_CHANNELS, made_up, k);
+                }
+                break;
+            }
+
+            if (in->concealed > 0) {
+                // the data is back: fade from the concealment into it, and
+                // drop as much late data as was made up
+                in->realign += in->concealed;
+                if (in->realign > MIXER_QUEUE * in->frames)
+                    in->realign = MIXER_QUEUE * in->frames;
+                conceal(in, in->xfade, CONCEAL_FADE);
+                in->xfade_frames = CONCEAL_FADE;
+                in->xfade_pos = 0;
+                in->concealed = 0;
+            }
+            in->started = 1;
+
+            if (in->realign > 0) {
+                realign(in, m->frames - mixed);
+                if (in->current == NULL)
+                    in->queue.pop(in->current);
+            }
+
+            n = in->frames - in->offset;
+            if (n > m->frames - mixed) n = m->frames - mixed;
+
+            mix_data(in, out + mixed * MIXER_CHANNELS, n);
+            if (in->offset == in->frames)
+                finish_buffer(in);
+        }
+    }
+
+    m->running.store(0);
+}
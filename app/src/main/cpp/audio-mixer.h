@@ -0,0 +1,97 @@
+//
+// Mixer of the player streams of an engine into its single player.
+//
+// Each output stream gets an input, which stands in for an OpenSL buffer
+// queue: the stream enqueues full buffers, the mixer sums them into the
+// engine player buffers, period after period, and calls back the stream
+// when a buffer has been consumed, as the player callback would.
+//
+// The input queue is also the jitter buffer of the stream: when it runs
+// dry after the stream started, the missing frames are concealed with a
+// crossfaded, decaying repeat of the last ones, and the data that then
+// arrives late is realigned by dropping as many frames as were concealed,
+// as far as the queue holds more than the depth the stream keeps.
+//
+
+#include <atomic>
+#include <stdint.h>
+#include "control-params.h"
+
+#ifndef TESTAUDIO_AUDIO_MIXER_H
+#define TESTAUDIO_AUDIO_MIXER_H
+
+#define MIXER_MAX_INPUTS 8
+#define MIXER_CHANNELS 2
+
+// buffers an input can have enqueued, a power of 2
+#define MIXER_QUEUE 4
+
+// concealment: the last CONCEAL_FRAMES frames, minus a CONCEAL_FADE
+// crossfade at each seam, are repeated, fading out to silence over
+// CONCEAL_MAX_FRAMES. Transitions in and out of it are crossfaded too.
+#define CONCEAL_FRAMES 512
+#define CONCEAL_FADE 64
+#define CONCEAL_MAX_FRAMES 4096
+
+// output statistics of a stream, written by the mixer, read by anyone
+typedef struct mixer_stats {
+    std::atomic<uint32_t> underruns;    // times the input ran dry
+    std::atomic<uint32_t> concealed;    // frames made up for them
+    std::atomic<uint32_t> realigned;    // late frames dropped afterwards
+} mixer_stats_t;
+
+// called by the mixer when a buffer has been consumed
+typedef void (*mixer_done_callback)(void *context);
+
+enum mixer_input_state {
+    MIXER_INPUT_FREE,
+    MIXER_INPUT_CLAIMED,    // being set up or torn down
+    MIXER_INPUT_LIVE        // mixed
+};
+
+typedef struct mixer_input {
+    std::atomic<int> state;
+    int channels;                   // 1 or MIXER_CHANNELS
+    int frames;                     // per buffer
+    int depth;                      // frames the stream keeps queued
+    mixer_done_callback done;
+    void *context;
+    mixer_stats_t *stats;
+
+    // full buffers, from the stream thread to the mixer
+    spsc_queue<const short *, MIXER_QUEUE> queue;
+
+    // mixer only: buffer being consumed and frames already consumed
+    const short *current;
+    int offset;
+
+    // mixer only: concealment
+    int started;                    // a buffer was mixed already
+    int concealed;                  // frames concealed in the current dropout
+    int realign;                    // frames still to drop, beyond depth
+    short hist[CONCEAL_FRAMES * MIXER_CHANNELS];    // last frames mixed
+    short xfade[CONCEAL_FADE * MIXER_CHANNELS];     // outgoing side of a transition
+    int xfade_frames, xfade_pos;
+} mixer_input_t;
+
+typedef struct audio_mixer {
+    mixer_input_t inputs[MIXER_MAX_INPUTS];
+    std::atomic<int> running;       // set while mixer_run looks at the inputs
+    int frames;                     // per period
+} audio_mixer_t;
+
+
+void mixer_init(audio_mixer_t *m, int frames);
+
+// stream side
+mixer_input_t *mixer_add_input(audio_mixer_t *m, int channels, int frames, int depth,
+                               mixer_done_callback done, void *context, mixer_stats_t *stats);
+void mixer_remove_input(audio_mixer_t *m, mixer_input_t *in);
+int mixer_enqueue(mixer_input_t *in, const short *buffer);
+
+// player side
+void mixer_run(audio_mixer_t *m, short *out);
+
+void mix_add(short *out, const short *in, int samples);
+
+#endif //TESTAUDIO_AUDIO_MIXER_H
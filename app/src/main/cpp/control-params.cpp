@@ -0,0 +1,75 @@
+//
+// Audio thread side of the control parameters: applies queued commands
+// and smooths the gain once per block.
+//
+
+#include <math.h>
+#include "control-params.h"
+
+
+static float control_target_gain(control_params_t *c) {
+    float gain;
+
+    if (c->mute.load(std::memory_order_relaxed) || !c->monitor.load(std::memory_order_relaxed))
+        return 0.f;
+
+    gain = c->gain.load(std::memory_order_relaxed);
+    if (gain < 0.f) gain = 0.f;
+    if (gain > CONTROL_MAX_GAIN) gain = CONTROL_MAX_GAIN;
+    return gain;
+}
+
+
+void control_init(control_state_t *s, control_params_t *c, int sample_rate) {
+    control_command_t cmd;
+
+    // the gain starts on its target: snaps queued while no stream was
+    // running have nothing left to do
+    while (c->commands.pop(cmd));
+
+    s->sample_rate = sample_rate;
+    s->gain = control_target_gain(c);
+}
+
+
+/*
+ * Called by the audio thread before processing a block of frames.
+ * Applies at most CONTROL_MAX_COMMANDS_PER_BLOCK commands and moves the
+ * gain towards its target with a one pole smoother evaluated at the
+ * block boundaries. Returns the gain ramp to apply over the block.
+ */
+gain_ramp_t control_begin_block(control_state_t *s, control_params_t *c, int frames) {
+    control_command_t cmd;
+    gain_ramp_t ramp;
+    float target, smoothing_ms;
+    int n;
+
+    target = control_target_gain(c);
+    smoothing_ms = c->smoothing_ms.load(std::memory_order_relaxed);
+
+    for (n = 0; n < CONTROL_MAX_COMMANDS_PER_BLOCK && c->commands.pop(cmd); n++) {
+        switch (cmd.type) {
+            case CONTROL_SNAP:
+                s->gain = target;
+                break;
+            default:
+                break;
+        }
+    }
+
+    ramp.start = s->gain;
+
+    if (smoothing_ms <= 0.f) {
+        s->gain = target;
+    } else {
+        float k = expf(-(float) frames * 1000.f / (smoothing_ms * s->sample_rate));
+        s->gain = target + (s->gain - target) * k;
+
+        // close enough: land exactly on the target so the flat paths apply
+        if (fabsf(s->gain - target) < 1e-4f)
+            s->gain = target;
+    }
+
+    ramp.end = s->gain;
+    return ramp;
+}
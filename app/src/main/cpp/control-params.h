@@ -0,0 +1,95 @@
+//
+// Control parameters sent from the UI thread to the audio thread.
+// Scalars are plain atomics, structured commands go through a single
+// producer / single consumer queue. Nothing here locks or allocates.
+//
+
+#include <atomic>
+#include <stdint.h>
+
+#ifndef TESTAUDIO_CONTROL_PARAMS_H
+#define TESTAUDIO_CONTROL_PARAMS_H
+
+// maximum number of commands applied per processed block, to bound
+// the worst case cost of a block; the rest waits for the next one
+#define CONTROL_MAX_COMMANDS_PER_BLOCK 8
+#define CONTROL_QUEUE_SIZE 64
+
+// default smoothing time of the gain, in ms
+#define CONTROL_SMOOTHING_MS 20.f
+
+#define CONTROL_MAX_GAIN 4.f
+
+
+/*
+ * Wait-free single producer / single consumer queue of N (a power of 2)
+ * items. push is only called from one thread, pop from one other thread.
+ */
+template <typename T, unsigned N>
+struct spsc_queue {
+    T items[N];
+    std::atomic<unsigned> head;  // next item to pop, written by the consumer
+    std::atomic<unsigned> tail;  // next free slot, written by the producer
+
+    spsc_queue() : head(0), tail(0) {}
+
+    bool push(const T &item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= N)
+            return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+
+enum control_command_type {
+    CONTROL_SNAP            // jump to the targets, no smoothing
+};
+
+typedef struct control_command {
+    int type;
+    float value;
+} control_command_t;
+
+
+// written by the UI thread, read by the audio thread
+typedef struct control_params {
+    std::atomic<float> gain;
+    std::atomic<bool>  mute;
+    std::atomic<bool>  monitor;
+    std::atomic<float> smoothing_ms;
+    spsc_queue<control_command_t, CONTROL_QUEUE_SIZE> commands;
+
+    control_params() : gain(1.f), mute(false), monitor(true), smoothing_ms(CONTROL_SMOOTHING_MS) {}
+} control_params_t;
+
+
+// gain to apply over one block, ramping linearly from start to end
+typedef struct gain_ramp {
+    float start;
+    float end;
+} gain_ramp_t;
+
+
+// audio thread side: the smoothed values
+typedef struct control_state {
+    float gain;           // current smoothed gain
+    int   sample_rate;
+} control_state_t;
+
+
+void control_init(control_state_t *s, control_params_t *c, int sample_rate);
+gain_ramp_t control_begin_block(control_state_t *s, control_params_t *c, int frames);
+
+#endif //TESTAUDIO_CONTROL_PARAMS_H
@@ -0,0 +1,140 @@
+//
+// Drift compensation between the capture and playback clocks
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "drift-comp.h"
+
+
+// target_blocks within DRIFT_MIN_BLOCKS to DRIFT_TARGET_BLOCKS; its
+// integer part is the number of player buffers kept queued
+double drift_target_blocks(double target_blocks) {
+    return target_blocks < DRIFT_MIN_BLOCKS ? DRIFT_MIN_BLOCKS :
+           (target_blocks > DRIFT_TARGET_BLOCKS ? DRIFT_TARGET_BLOCKS : target_blocks);
+}
+
+
+/*
+ * Set up the compensation for blocks of block_frames frames, holding the
+ * latency at target_blocks blocks, see drift_target_blocks.
+ * Returns 0, or -1 if the FIFO cannot be allocated.
+ */
+int drift_init(drift_comp_t *d, int channels, int block_frames, double target_blocks) {
+    memset(d, 0, sizeof(drift_comp_t));
+
+    if (channels < 1 || channels > DRIFT_MAX_CHANNELS)
+        return -1;
+
+    d->channels = channels;
+    d->block_frames = block_frames;
+    d->target_blocks = drift_target_blocks(target_blocks);
+    d->ratio = 1.;
+    d->pos = 1.;
+    d->fifo_frames = 4 * block_frames;
+    d->fifo = (short *) calloc((size_t) d->fifo_frames * channels, sizeof(short));
+    if (d->fifo == NULL)
+        return -1;
+
+    // start at the target latency: silence for all but the first block
+    d->fifo_fill = (int) (d->target_blocks * block_frames) - block_frames;
+    return 0;
+}
+
+
+void drift_free(drift_comp_t *d) {
+    free(d->fifo);
+    d->fifo = NULL;
+}
+
+
+// 4 point, 3rd order Hermite interpolation between x1 and x2
+static inline float hermite(float x0, float x1, float x2, float x3, float t) {
+    float c1 = .5f * (x2 - x0);
+    float c2 = x0 - 2.5f * x1 + 2.f * x2 - .5f * x3;
+    float c3 = .5f * (x3 - x0) + 1.5f * (x1 - x2);
+    return ((c3 * t + c2) * t + c1) * t + x1;
+}
+
+
+/*
+ * Resample frames frames of in at the current ratio and append them to
+ * the FIFO. Positions are counted in the sequence made of the last 3
+ * input frames of the previous block followed by in; pos is between
+ * frames 1 and frames + 1 of it, so that 4 points are always available.
+ * Output that does not fit in the FIFO is dropped.
+ * Returns the number of frames appended.
+ */
+int drift_resample(drift_comp_t *d, const short *in, int frames) {
+    int ch = d->channels, c, k, n = 0, i;
+    short *out = d->fifo + d->fifo_fill * ch;
+    int room = d->fifo_frames - d->fifo_fill;
+    float x[4], v;
+
+    for (; (k = (int) d->pos) <= frames; d->pos += d->ratio) {
+        float t = (float) (d->pos - k);
+
+        if (n == room) continue;
+
+        for (c = 0; c < ch; c++) {
+            for (i = 0; i < 4; i++) {
+                int j = k - 1 + i;
+                x[i] = j < 3 ? d->hist[j * ch + c] : (float) in[(j - 3) * ch + c];
+            }
+            v = hermite(x[0], x[1], x[2], x[3], t);
+            out[n * ch + c] = (short) (v > 32767.f ? 32767 : (v < -32768.f ? -32768 : v));
+        }
+        n++;
+    }
+
+    // the last 3 frames become the history of the next block
+    for (i = 0; i < 3; i++) {
+        int j = frames + i;
+        for (c = 0; c < ch; c++)
+            d->hist[i * ch + c] = j < 3 ? d->hist[j * ch + c] : (float) in[(j - 3) * ch + c];
+    }
+    d->pos -= frames;
+
+    d->fifo_fill += n;
+    return n;
+}
+
+
+// remove frames frames, already read from d->fifo, from the head of the FIFO
+void drift_fifo_drop(drift_comp_t *d, int frames) {
+    int ch = d->channels;
+
+    memmove(d->fifo, d->fifo + frames * ch, (size_t) (d->fifo_fill - frames) * ch * sizeof(short));
+    d->fifo_fill -= frames;
+}
+
+
+/*
+ * Feed the monitor latency in frames, measured once per capture block,
+ * and adjust the ratio to bring it to the target.
+ */
+void drift_update(drift_comp_t *d, double latency) {
+    double e, dev, max = DRIFT_MAX_PPM * 1e-6;
+
+    if (d->blocks < DRIFT_SETTLE_BLOCKS) {
+        d->blocks++;
+        d->target = d->target_blocks * d->block_frames;
+        d->latency = d->target;
+        return;
+    }
+
+    d->latency += (latency - d->latency) * DRIFT_AVG_WEIGHT;
+    e = d->latency - d->target;
+
+    // too much latency: the input runs faster, consume more of it
+    d->integral += DRIFT_KI * e;
+    if (d->integral > max) d->integral = max;
+    if (d->integral < -max) d->integral = -max;
+
+    dev = d->integral + DRIFT_KP * e;
+    if (dev > max) dev = max;
+    if (dev < -max) dev = -max;
+    d->ratio = 1. + dev;
+
+    d->ppm = d->integral * 1e6;
+}
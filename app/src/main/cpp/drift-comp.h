@@ -0,0 +1,69 @@
+//
+// Drift compensation between the capture and playback clocks.
+//
+// Captured frames go through an adaptive resampler into a small FIFO,
+// from which the player buffers are filled. The monitor latency (FIFO
+// plus queued player buffers) is measured once per capture block; a PI
+// controller adjusts the resampling ratio so that it stays constant, and
+// the ratio gives the measured drift.
+//
+
+#include <stdint.h>
+
+#ifndef TESTAUDIO_DRIFT_COMP_H
+#define TESTAUDIO_DRIFT_COMP_H
+
+#define DRIFT_MAX_CHANNELS 2
+
+// blocks before the controller starts, while the player queue fills up
+#define DRIFT_SETTLE_BLOCKS 16
+
+// default latency target in blocks: the 3 queued player buffers plus a
+// FIFO reserve of half a block, which absorbs callback jitter. Smaller
+// targets keep fewer player buffers queued, down to DRIFT_MIN_BLOCKS.
+#define DRIFT_TARGET_BLOCKS 3.5
+#define DRIFT_MIN_BLOCKS 1.5
+
+// latency low pass filter weight and PI gains, per block. With 1024
+// frame blocks at 44.1 kHz the loop has a time constant of about a
+// minute, slow enough to average out the block sized latency steps.
+#define DRIFT_AVG_WEIGHT 0.01
+#define DRIFT_KP 2e-6               // per frame of latency error
+#define DRIFT_KI 5e-10              // per frame of latency error and block
+
+// the ratio is kept within 1 +/- DRIFT_MAX_PPM
+#define DRIFT_MAX_PPM 1000.
+
+typedef struct drift_comp {
+    int    channels;
+    int    block_frames;
+    double target_blocks;           // player buffers queued, plus a reserve
+
+    // resampler
+    double ratio;                   // input frames consumed per output frame
+    double pos;                     // read position, see drift_resample
+    float  hist[3 * DRIFT_MAX_CHANNELS];
+
+    // FIFO between the resampler and the player buffers
+    short  *fifo;
+    int    fifo_frames;             // capacity
+    int    fifo_fill;
+
+    // estimator
+    int    blocks;
+    double latency;                 // filtered latency, frames
+    double target;
+    double integral;
+    double ppm;                     // filtered drift estimate
+} drift_comp_t;
+
+
+double drift_target_blocks(double target_blocks);
+int drift_init(drift_comp_t *d, int channels, int block_frames, double target_blocks);
+void drift_free(drift_comp_t *d);
+
+int drift_resample(drift_comp_t *d, const short *in, int frames);
+void drift_fifo_drop(drift_comp_t *d, int frames);
+void drift_update(drift_comp_t *d, double latency);
+
+#endif //TESTAUDIO_DRIFT_COMP_H
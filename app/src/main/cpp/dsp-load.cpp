@@ -0,0 +1,139 @@
+//
+// DSP load meter
+//
+
+#include "dsp-load.h"
+
+
+static double elapsed(struct timespec *last, clockid_t clock) {
+    struct timespec now;
+    double d;
+
+    clock_gettime(clock, &now);
+    d = (double) (now.tv_sec - last->tv_sec) + (double) (now.tv_nsec - last->tv_nsec) * 1e-9;
+    *last = now;
+    return d;
+}
+
+
+static void stat_reset(dsp_load_stat_t *s) {
+    int i;
+    s->avg.store(0.f, std::memory_order_relaxed);
+    s->max.store(0.f, std::memory_order_relaxed);
+    for (i = 0; i < LOAD_HIST_BINS; i++)
+        s->hist[i].store(0, std::memory_order_relaxed);
+}
+
+
+static void stat_add(dsp_load_stat_t *s, float load, int decay, int first) {
+    int i, bin = (int) (load * 100.f);
+
+    if (bin >= LOAD_HIST_BINS) bin = LOAD_HIST_BINS - 1;
+    if (bin < 0) bin = 0;
+
+    if (decay) {
+        for (i = 0; i < LOAD_HIST_BINS; i++)
+            s->hist[i].store(s->hist[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    s->hist[bin].store(s->hist[bin].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    float avg = first ? load : s->avg.load(std::memory_order_relaxed);
+    s->avg.store(avg + (load - avg) * LOAD_AVG_WEIGHT, std::memory_order_relaxed);
+
+    if (load > s->max.load(std::memory_order_relaxed))
+        s->max.store(load, std::memory_order_relaxed);
+}
+
+
+static float stat_p99(dsp_load_stat_t *s) {
+    uint32_t counts[LOAD_HIST_BINS], total = 0, sum = 0;
+    int i;
+
+    for (i = 0; i < LOAD_HIST_BINS; i++) {
+        counts[i] = s->hist[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) return 0.f;
+
+    for (i = 0; i < LOAD_HIST_BINS; i++) {
+        sum += counts[i];
+        if ((uint64_t) sum * 100 >= (uint64_t) total * 99)
+            break;
+    }
+    return (float) (i + 1) / 100.f;
+}
+
+
+/*
+ * Clear the statistics and start timing. Called by the audio thread
+ * right before entering its processing loop.
+ */
+void dsp_load_reset(dsp_load_meter_t *m, int sample_rate) {
+    int i;
+
+    for (i = 0; i < LOAD_STAGES; i++) {
+        stat_reset(&m->cpu[i]);
+        stat_reset(&m->wall[i]);
+        m->stage_cpu[i] = m->stage_wall[i] = 0.;
+    }
+    m->iterations.store(0, std::memory_order_relaxed);
+    m->sample_rate = sample_rate;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &m->last_cpu);
+    clock_gettime(CLOCK_MONOTONIC, &m->last_wall);
+}
+
+
+// charge the time since the previous mark to stage
+void dsp_load_mark(dsp_load_meter_t *m, int stage) {
+    m->stage_cpu[stage] += elapsed(&m->last_cpu, CLOCK_THREAD_CPUTIME_ID);
+    m->stage_wall[stage] += elapsed(&m->last_wall, CLOCK_MONOTONIC);
+}
+
+
+/*
+ * End of an iteration that moved frames frames: turn the stage times into
+ * fractions of the period and add them to the statistics.
+ */
+void dsp_load_end(dsp_load_meter_t *m, int frames) {
+    double period = (double) frames / m->sample_rate;
+    uint32_t n;
+    int i, decay;
+
+    // nothing moved: drop the time rather than charge it to the next iteration
+    if (frames <= 0) {
+        for (i = 0; i < LOAD_STAGES; i++)
+            m->stage_cpu[i] = m->stage_wall[i] = 0.;
+        return;
+    }
+
+    n = m->iterations.load(std::memory_order_relaxed) + 1;
+    m->iterations.store(n, std::memory_order_relaxed);
+    decay = (n % LOAD_WINDOW) == 0;
+
+    m->stage_cpu[LOAD_TOTAL] = m->stage_wall[LOAD_TOTAL] = 0.;
+    for (i = 0; i < LOAD_TOTAL; i++) {
+        m->stage_cpu[LOAD_TOTAL] += m->stage_cpu[i];
+        m->stage_wall[LOAD_TOTAL] += m->stage_wall[i];
+    }
+
+    for (i = 0; i < LOAD_STAGES; i++) {
+        stat_add(&m->cpu[i], (float) (m->stage_cpu[i] / period), decay, n == 1);
+        stat_add(&m->wall[i], (float) (m->stage_wall[i] / period), decay, n == 1);
+        m->stage_cpu[i] = m->stage_wall[i] = 0.;
+    }
+}
+
+
+void dsp_load_read(dsp_load_meter_t *m, dsp_load_report_t report[LOAD_STAGES]) {
+    int i;
+
+    for (i = 0; i < LOAD_STAGES; i++) {
+        report[i].cpu_avg = m->cpu[i].avg.load(std::memory_order_relaxed);
+        report[i].cpu_p99 = stat_p99(&m->cpu[i]);
+        report[i].cpu_max = m->cpu[i].max.load(std::memory_order_relaxed);
+        report[i].wall_avg = m->wall[i].avg.load(std::memory_order_relaxed);
+        report[i].wall_p99 = stat_p99(&m->wall[i]);
+        report[i].wall_max = m->wall[i].max.load(std::memory_order_relaxed);
+    }
+}
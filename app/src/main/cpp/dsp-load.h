@@ -0,0 +1,66 @@
+//
+// DSP load meter: CPU (thread clock) and wall time of each iteration of
+// the processing loop, per stage, as a fraction of the buffer period.
+// Written by the audio thread, read at any time from other threads.
+//
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef TESTAUDIO_DSP_LOAD_H
+#define TESTAUDIO_DSP_LOAD_H
+
+enum dsp_load_stage {
+    LOAD_CAPTURE,   // waiting for and taking a capture buffer
+    LOAD_PROCESS,   // processing code
+    LOAD_PLAYBACK,  // waiting for and handing over a player buffer
+    LOAD_TOTAL,     // the whole iteration
+    LOAD_STAGES
+};
+
+// histogram bins of 1% of the period, the last one also counts overloads
+#define LOAD_HIST_BINS 200
+
+// iterations between halvings of the histograms, so the p99 follows
+// the recent past rather than the whole session
+#define LOAD_WINDOW 1024
+
+// weight of the last iteration in the rolling average
+#define LOAD_AVG_WEIGHT 0.05f
+
+typedef struct dsp_load_stat {
+    std::atomic<float>    avg;
+    std::atomic<float>    max;
+    std::atomic<uint32_t> hist[LOAD_HIST_BINS];
+} dsp_load_stat_t;
+
+typedef struct dsp_load_meter {
+    dsp_load_stat_t cpu[LOAD_STAGES];
+    dsp_load_stat_t wall[LOAD_STAGES];
+    std::atomic<uint32_t> iterations;
+
+    // audio thread only
+    struct timespec last_cpu;
+    struct timespec last_wall;
+    double stage_cpu[LOAD_STAGES];
+    double stage_wall[LOAD_STAGES];
+    int sample_rate;
+} dsp_load_meter_t;
+
+// loads as fractions of the buffer period (1 = the whole period)
+typedef struct dsp_load_report {
+    float cpu_avg, cpu_p99, cpu_max;
+    float wall_avg, wall_p99, wall_max;
+} dsp_load_report_t;
+
+
+// audio thread
+void dsp_load_reset(dsp_load_meter_t *m, int sample_rate);
+void dsp_load_mark(dsp_load_meter_t *m, int stage);
+void dsp_load_end(dsp_load_meter_t *m, int frames);
+
+// any thread
+void dsp_load_read(dsp_load_meter_t *m, dsp_load_report_t report[LOAD_STAGES]);
+
+#endif //TESTAUDIO_DSP_LOAD_H
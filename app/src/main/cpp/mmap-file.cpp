@@ -0,0 +1,135 @@
+//
+// Memory mapped sequential file writer
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "mmap-file.h"
+
+
+// make sure the file covers [0, end[, preallocating the blocks if possible.
+// This is done one window at a time: preallocating a whole segment up front
+// leaves a large unwritten extent that makes every page fault slower on ext4.
+static int mmap_writer_reserve(mmap_writer_t *w, off_t end) {
+    if (end <= w->allocated)
+        return 0;
+
+    if (fallocate(w->fd, 0, w->allocated, end - w->allocated) != 0) {
+        // not supported by every file system: a sparse extension still
+        // keeps the mapping valid. Any other error, ENOSPC first, would
+        // turn into a SIGBUS on a mapped page: write through pwrite instead
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+            return -1;
+        if (ftruncate(w->fd, end) != 0)
+            return -1;
+    }
+    w->allocated = end;
+    return 0;
+}
+
+
+// map the window starting at offset; without a window the writer falls back to pwrite
+static void mmap_writer_map(mmap_writer_t *w, off_t offset) {
+    void *m;
+
+    if (w->window != NULL) {
+        munmap(w->window, MMAP_WINDOW);
+        w->window = NULL;
+    }
+
+    w->window_offset = offset;
+    w->window_pos = 0;
+
+    if (mmap_writer_reserve(w, offset + MMAP_WINDOW) != 0)
+        return;
+
+    m = mmap(NULL, MMAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, offset);
+    if (m != MAP_FAILED)
+        w->window = (char *) m;
+}
+
+
+/*
+ * Create (or truncate) the file at path.
+ * Returns NULL if the file cannot be created.
+ */
+mmap_writer_t *mmap_writer_open(const char *path) {
+    mmap_writer_t *w;
+
+    w = (mmap_writer_t *) calloc(sizeof(mmap_writer_t), (size_t) 1);
+    if (w == NULL)
+        return NULL;
+
+    if ((w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        free(w);
+        return NULL;
+    }
+
+    mmap_writer_map(w, 0);
+    return w;
+}
+
+
+/*
+ * Append size bytes to the file.
+ * Returns 0, or -1 on error.
+ */
+int mmap_writer_write(mmap_writer_t *w, const void *data, size_t size) {
+    const char *d = (const char *) data;
+    size_t n;
+
+    while (size > 0) {
+        if (w->window == NULL) {
+            // no mapping: plain writes, retrying the mapping at the next stride
+            n = MMAP_WINDOW - w->window_pos;
+            if (n > size) n = size;
+            if (pwrite(w->fd, d, n, w->window_offset + (off_t) w->window_pos) != (ssize_t) n)
+                return -1;
+        } else {
+            n = MMAP_WINDOW - w->window_pos;
+            if (n > size) n = size;
+            memcpy(w->window + w->window_pos, d, n);
+        }
+
+        w->window_pos += n;
+        w->length += n;
+        d += n;
+        size -= n;
+
+        if (w->window_pos == MMAP_WINDOW)
+            mmap_writer_map(w, w->window_offset + MMAP_WINDOW);
+    }
+    return 0;
+}
+
+
+// overwrite already written bytes, e.g. a header
+int mmap_writer_pwrite(mmap_writer_t *w, off_t offset, const void *data, size_t size) {
+    return pwrite(w->fd, data, size, offset) == (ssize_t) size ? 0 : -1;
+}
+
+
+/*
+ * Unmap, trim the preallocated tail and close the file.
+ * Returns 0, or -1 on error.
+ */
+int mmap_writer_close(mmap_writer_t *w) {
+    int result = 0;
+
+    if (w == NULL)
+        return 0;
+
+    if (w->window != NULL)
+        munmap(w->window, MMAP_WINDOW);
+    if (ftruncate(w->fd, w->length) != 0)
+        result = -1;
+    if (close(w->fd) != 0)
+        result = -1;
+
+    free(w);
+    return result;
+}
@@ -0,0 +1,32 @@
+//
+// Sequential file writer through a memory mapped window. The file is
+// preallocated for each window as it advances in large strides, so
+// writing costs a memcpy and a few syscalls per stride instead of one
+// write per buffer.
+//
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef TESTAUDIO_MMAP_FILE_H
+#define TESTAUDIO_MMAP_FILE_H
+
+// size of the mapped window, a multiple of the page size
+#define MMAP_WINDOW (1024 * 1024)
+
+typedef struct mmap_writer {
+    int    fd;
+    char   *window;         // mapping of [window_offset, window_offset + MMAP_WINDOW[
+    off_t  window_offset;
+    size_t window_pos;      // write position in the window
+    off_t  allocated;       // bytes preallocated in the file
+    off_t  length;          // bytes written
+} mmap_writer_t;
+
+
+mmap_writer_t *mmap_writer_open(const char *path);
+int mmap_writer_write(mmap_writer_t *w, const void *data, size_t size);
+int mmap_writer_pwrite(mmap_writer_t *w, off_t offset, const void *data, size_t size);
+int mmap_writer_close(mmap_writer_t *w);
+
+#endif //TESTAUDIO_MMAP_FILE_H
@@ -1,8 +1,16 @@
 #include <jni.h>
+#include <new>
 #include <string>
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
 #include "native-lib.h"
+#include "sample-format.h"
+#include "control-params.h"
+#include "dsp-load.h"
+#include "segment-recorder.h"
+#include "shm-export.h"
+#include "drift-comp.h"
+#include "wav-file.h"
 
 
 static void *createThreadLock(void);
@@ -11,41 +19,79 @@ static void notifyThreadLock(void *lock);
 static void destroyThreadLock(void *lock);
 static void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context);
 static void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq, void *context);
+static void openSLOutputDone(void *context);
 static SLresult openSLRecOpen(opensl_stream_t *p);
-static SLresult openSLPlayOpen(opensl_stream_t *p);
-
-#define CONV16BIT 32768
-#define CONVMYFLT (1./32768.)
-
-
-#ifdef __cplusplus
-extern "C" {
-#endif
+static SLresult openSLPlayOpen(opensl_engine_t *e);
 
 #define BUFFERFRAMES 1024
 #define VECSAMPS_MONO 64
 #define VECSAMPS_STEREO 128
 #define SAMPLE_RATE 44100
 
-FILE* pcmFile;
+// sample type of the processing pipeline (short, int32_t or float),
+// chosen at build time. With short the capture buffers are processed
+// in place into the player buffers, without any intermediate copy.
+#ifndef PIPELINE_SAMPLE
+#define PIPELINE_SAMPLE short
+#endif
+
+typedef PIPELINE_SAMPLE pipeline_sample_t;
+
+/*
+ * A monitoring session: a capture to playback, capture only or playback
+ * only stream on the shared engine, its processing parameters and what
+ * is done with its input. Java holds it as a long handle, see opensession.
+ */
+typedef struct audio_session {
+    opensl_engine_t *engine;
+    int sample_rate;
+    int inchannels;                 // 0 for playback only
+    int outchannels;                // 0 for capture only
+    std::atomic<int> on;
+    control_params_t controls;
+    dsp_load_meter_t load;
+
+    // drift of the capture clock against the playback clock, in ppm
+    // (positive: capture runs fast), see getdrift
+    std::atomic<float> drift_ppm;
+
+    // output buffering in blocks, set with setjitter before startprocess,
+    // and what it did not absorb, see getjitter
+    double jitter_blocks;
+    mixer_stats_t jitter;
+
+    // recording output, set with setrecording before startprocess
+    char record_dir[PATH_MAX];
+    char record_prefix[SEGMENT_PREFIX_MAX];
+    double record_segment_seconds;
+    segment_recorder_t *recorder;
+
+    // what a playback only session plays, set with setsource before startprocess
+    char source_path[PATH_MAX];
+
+    // live export of the captured stream to other processes, see setexport
+    std::atomic<bool> export_enabled;
+    std::atomic<int> export_fd;
+    shm_export_t *exporter;
+} audio_session_t;
 
 /*
  * create the OpenSL ES audio engine
  */
-static SLresult openSLCreateEngine(opensl_stream_t *p) {
+static SLresult openSLCreateEngine(opensl_engine_t *e) {
     SLresult result;
 
 
     // create engine
-    result = slCreateEngine(&(p->engineObject), 0, NULL, 0, NULL, NULL);
+    result = slCreateEngine(&(e->engineObject), 0, NULL, 0, NULL, NULL);
     if (result != SL_RESULT_SUCCESS) goto engine_end;
 
     // realize the engine
-    result = (*p->engineObject)->Realize(p->engineObject, SL_BOOLEAN_FALSE);
+    result = (*e->engineObject)->Realize(e->engineObject, SL_BOOLEAN_FALSE);
     if (result != SL_RESULT_SUCCESS) goto engine_end;
 
     // get the engine interface, which is needed in order to create other objects
-    result = (*p->engineObject)->GetInterface(p->engineObject, SL_IID_ENGINE, &(p->engineEngine));
+    result = (*e->engineObject)->GetInterface(e->engineObject, SL_IID_ENGINE, &(e->engineEngine));
     if (result != SL_RESULT_SUCCESS) goto engine_end;
 
     engine_end:
@@ -54,49 +100,134 @@ static SLresult openSLCreateEngine(opensl_stream_t *p) {
 }
 
 
-// close the OpenSL IO and destroy the audio engine
-static void openSLDestroyEngine(opensl_stream_t *p) {
+// close the mix player and destroy the audio engine
+static void openSLDestroyEngine(opensl_engine_t *e) {
 
 
     // destroy buffer queue audio player object, and invalidate all associated interfaces
-    if (p->bqPlayerObject != NULL) {
-        (*p->bqPlayerObject)->Destroy(p->bqPlayerObject);
-        p->bqPlayerObject = NULL;
-        p->bqPlayerPlay = NULL;
-        p->bqPlayerBufferQueue = NULL;
-        p->bqPlayerEffectSend = NULL;
-    }
-
-    // destroy audio recorder object, and invalidate all associated interfaces
-    if (p->recorderObject != NULL) {
-        (*p->recorderObject)->Destroy(p->recorderObject);
-        p->recorderObject = NULL;
-        p->recorderRecord = NULL;
-        p->recorderBufferQueue = NULL;
+    if (e->bqPlayerObject != NULL) {
+        (*e->bqPlayerObject)->Destroy(e->bqPlayerObject);
+        e->bqPlayerObject = NULL;
+        e->bqPlayerPlay = NULL;
+        e->bqPlayerBufferQueue = NULL;
+        e->bqPlayerEffectSend = NULL;
     }
 
     // destroy output mix object, and invalidate all associated interfaces
-    if (p->outputMixObject != NULL) {
-        (*p->outputMixObject)->Destroy(p->outputMixObject);
-        p->outputMixObject = NULL;
+    if (e->outputMixObject != NULL) {
+        (*e->outputMixObject)->Destroy(e->outputMixObject);
+        e->outputMixObject = NULL;
     }
 
     // destroy engine object, and invalidate all associated interfaces
-    if (p->engineObject != NULL) {
-        (*p->engineObject)->Destroy(p->engineObject);
-        p->engineObject = NULL;
-        p->engineEngine = NULL;
+    if (e->engineObject != NULL) {
+        (*e->engineObject)->Destroy(e->engineObject);
+        e->engineObject = NULL;
+        e->engineEngine = NULL;
     }
 
 }
 
-// shut down the native audio system
+
+// shut down the native audio system, once all its streams are closed
+void android_CloseAudioEngine(opensl_engine_t *e) {
+
+    if (e == NULL)
+        return;
+
+    openSLDestroyEngine(e);
+
+    for (int i = 0; i < MIX_BUFFERS; i++)
+        free(e->mixBuffer[i]);
+
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+
+/*
+  Create and realize the OpenSL engine and its player, to which all the
+  output streams are mixed, at the given sampling rate and with periods
+  of bufferframes frames. Only one engine can exist in a process.
+  Returns a handle to the engine, for android_OpenAudioDevice.
+*/
+opensl_engine_t *android_OpenAudioEngine(int sample_rate, int bufferframes) {
+
+    opensl_engine_t *e;
+    e = (opensl_engine_t *) calloc(sizeof(opensl_engine_t), (size_t) 1);
+    if (e == NULL)
+        return NULL;
+
+    e->sample_rate = sample_rate;
+    e->bufferframes = bufferframes;
+    pthread_mutex_init(&e->lock, (pthread_mutexattr_t *) NULL);
+    mixer_init(&e->mixer, bufferframes);
+
+    for (int i = 0; i < MIX_BUFFERS; i++) {
+        if ((e->mixBuffer[i] = (short *) calloc((size_t) bufferframes * MIXER_CHANNELS,
+                                                sizeof(short))) == NULL) {
+            android_CloseAudioEngine(e);
+            return NULL;
+        }
+    }
+
+    if (openSLCreateEngine(e) != SL_RESULT_SUCCESS ||
+        openSLPlayOpen(e) != SL_RESULT_SUCCESS) {
+        android_CloseAudioEngine(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+
+/*
+ * Start the engine player at the first output stream, stop it after the
+ * last one, so that it does not play silence when there is nothing to mix.
+ */
+static void openSLEngineOutputs(opensl_engine_t *e, int change) {
+    pthread_mutex_lock(&e->lock);
+
+    e->outputs += change;
+
+    if (change > 0 && e->outputs == 1) {
+        // prime the queue, the callback keeps it full from then on
+        e->currentMixBuffer = 0;
+        for (int i = 0; i < MIX_BUFFERS; i++) {
+            mixer_run(&e->mixer, e->mixBuffer[i]);
+            (*e->bqPlayerBufferQueue)->Enqueue(e->bqPlayerBufferQueue, e->mixBuffer[i],
+                                               e->bufferframes * MIXER_CHANNELS * sizeof(short));
+        }
+        (*e->bqPlayerPlay)->SetPlayState(e->bqPlayerPlay, SL_PLAYSTATE_PLAYING);
+    } else if (change < 0 && e->outputs == 0) {
+        (*e->bqPlayerPlay)->SetPlayState(e->bqPlayerPlay, SL_PLAYSTATE_STOPPED);
+        (*e->bqPlayerBufferQueue)->Clear(e->bqPlayerBufferQueue);
+    }
+
+    pthread_mutex_unlock(&e->lock);
+}
+
+
+// close a stream of the engine
 void android_CloseAudioDevice(opensl_stream_t *p) {
 
     if (p == NULL)
         return;
 
-    openSLDestroyEngine(p);
+    // destroy audio recorder object, and invalidate all associated interfaces
+    if (p->recorderObject != NULL) {
+        (*p->recorderObject)->Destroy(p->recorderObject);
+        p->recorderObject = NULL;
+        p->recorderRecord = NULL;
+        p->recorderBufferQueue = NULL;
+    }
+
+    // from here on the mixer no longer reads the output buffers
+    if (p->mixerInput != NULL) {
+        mixer_remove_input(&p->engine->mixer, p->mixerInput);
+        p->mixerInput = NULL;
+        openSLEngineOutputs(p->engine, -1);
+    }
 
     if (p->inlock != NULL) {
         notifyThreadLock(p->inlock);
@@ -110,14 +241,11 @@ void android_CloseAudioDevice(opensl_stream_t *p) {
         p->inlock = NULL;
     }
 
-    if (p->outputBuffer[0] != NULL) {
-        free(p->outputBuffer[0]);
-        p->outputBuffer[0] = NULL;
-    }
-
-    if (p->outputBuffer[1] != NULL) {
-        free(p->outputBuffer[1]);
-        p->outputBuffer[1] = NULL;
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        if (p->outputBuffer[i] != NULL) {
+            free(p->outputBuffer[i]);
+            p->outputBuffer[i] = NULL;
+        }
     }
 
     if (p->inputBuffer[0] != NULL) {
@@ -134,19 +262,33 @@ void android_CloseAudioDevice(opensl_stream_t *p) {
 }
 
 /*
-  Open the audio device with a given sampling rate, input and
-  output channels and IO buffer size in frames.
+  Open a stream of the engine e with a given sampling rate, input and
+  output channels and IO buffer size in frames. Streams with outputs
+  must run at the engine sampling rate, as they are mixed without
+  resampling; capture only streams can use any rate. depth is the number
+  of output frames the stream keeps queued to the mixer, past which late
+  output is dropped after an underrun, counted in stats if not NULL.
   Returns a handle to the OpenSL stream
 */
 opensl_stream_t *android_OpenAudioDevice(
+        opensl_engine_t *e,
         int sample_rate,
         int inchannels,
         int outchannels,
-        int bufferframes) {
+        int bufferframes,
+        int depth,
+        mixer_stats_t *stats) {
 
     opensl_stream_t *p;
+
+    if (outchannels && sample_rate != e->sample_rate)
+        return NULL;
+
     p = (opensl_stream_t *) calloc(sizeof(opensl_stream_t), (size_t) 1);
+    if (p == NULL)
+        return NULL;
 
+    p->engine = e;
     p->inchannels = inchannels;
     p->outchannels = outchannels;
     p->sample_rate = sample_rate;
@@ -155,10 +297,11 @@ opensl_stream_t *android_OpenAudioDevice(
 
     if ((p->outBufSamples = bufferframes * outchannels) != 0) {
 
-        if ((p->outputBuffer[0] = (short *) calloc((size_t) p->outBufSamples, sizeof(short))) == NULL ||
-            (p->outputBuffer[1] = (short *) calloc((size_t) p->outBufSamples, sizeof(short))) == NULL) {
-            android_CloseAudioDevice(p);
-            return NULL;
+        for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+            if ((p->outputBuffer[i] = (short *) calloc((size_t) p->outBufSamples, sizeof(short))) == NULL) {
+                android_CloseAudioDevice(p);
+                return NULL;
+            }
         }
 
     }
@@ -176,19 +319,18 @@ opensl_stream_t *android_OpenAudioDevice(
     p->currentInputIndex = p->inBufSamples;
     p->currentInputBuffer = 0;
 
-    if (openSLCreateEngine(p) != SL_RESULT_SUCCESS) {
-        android_CloseAudioDevice(p);
-        return NULL;
-    }
-
     if (openSLRecOpen(p) != SL_RESULT_SUCCESS) {
         android_CloseAudioDevice(p);
         return NULL;
     }
 
-    if (openSLPlayOpen(p) != SL_RESULT_SUCCESS) {
-        android_CloseAudioDevice(p);
-        return NULL;
+    if (outchannels) {
+        if ((p->mixerInput = mixer_add_input(&e->mixer, outchannels, bufferframes, depth,
+                                             openSLOutputDone, p, stats)) == NULL) {
+            android_CloseAudioDevice(p);
+            return NULL;
+        }
+        openSLEngineOutputs(e, 1);
     }
 
     notifyThreadLock(p->outlock);
@@ -200,19 +342,19 @@ opensl_stream_t *android_OpenAudioDevice(
 
 
 /*
- * opens the OpenSL ES device for output
- * source : a buffer queue in PCM format, which is where we will send our audio data samples.
+ * opens the OpenSL ES device for output, stopped until the first output stream
+ * source : a buffer queue in PCM format, which is where we will send the mix.
  * sink : an output mix
  */
-static SLresult openSLPlayOpen(opensl_stream_t *p) {
+static SLresult openSLPlayOpen(opensl_engine_t *e) {
     SLresult result;
-    SLuint32 sample_rate = (SLuint32) p->sample_rate;
-    SLuint32 channels = (SLuint32) p->outchannels;
+    SLuint32 sample_rate = (SLuint32) e->sample_rate;
+    SLuint32 channels = (SLuint32) MIXER_CHANNELS;
 
     if (channels) {
         // configure audio source
         SLDataLocator_AndroidSimpleBufferQueue loc_bufq =
-                {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 2};
+                {SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, MIX_BUFFERS};
 
         switch (sample_rate) {
 
@@ -258,9 +400,9 @@ static SLresult openSLPlayOpen(opensl_stream_t *p) {
 
         const SLInterfaceID ids[] = {SL_IID_VOLUME};
         const SLboolean req[] = {SL_BOOLEAN_FALSE};
-        result = (*p->engineEngine)->CreateOutputMix(
-                p->engineEngine, // the engine
-                &(p->outputMixObject), // the objectif
+        result = (*e->engineEngine)->CreateOutputMix(
+                e->engineEngine, // the engine
+                &(e->outputMixObject), // the objectif
                 1, ids, req);
 
         if (result != SL_RESULT_SUCCESS) return result;
@@ -270,7 +412,7 @@ static SLresult openSLPlayOpen(opensl_stream_t *p) {
         /*  realize the output mix */
         /***************************/
 
-        result = (*p->outputMixObject)->Realize(p->outputMixObject, SL_BOOLEAN_FALSE);
+        result = (*e->outputMixObject)->Realize(e->outputMixObject, SL_BOOLEAN_FALSE);
 
         int speakers;
         if (channels > 1)
@@ -290,15 +432,15 @@ static SLresult openSLPlayOpen(opensl_stream_t *p) {
         SLDataSource audioSrc = {&loc_bufq, &format_pcm};
 
         // configure audio output sink
-        SLDataLocator_OutputMix loc_outmix = {SL_DATALOCATOR_OUTPUTMIX, p->outputMixObject};
+        SLDataLocator_OutputMix loc_outmix = {SL_DATALOCATOR_OUTPUTMIX, e->outputMixObject};
         SLDataSink audioSnk = {&loc_outmix, NULL};
 
         // create audio player
         const SLInterfaceID ids1[] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE};
         const SLboolean req1[] = {SL_BOOLEAN_TRUE};
-        result = (*p->engineEngine)->CreateAudioPlayer(
-                p->engineEngine,
-                &(p->bqPlayerObject),
+        result = (*e->engineEngine)->CreateAudioPlayer(
+                e->engineEngine,
+                &(e->bqPlayerObject),
                 &audioSrc,
                 &audioSnk,
                 1,
@@ -308,32 +450,28 @@ static SLresult openSLPlayOpen(opensl_stream_t *p) {
         if (result != SL_RESULT_SUCCESS) goto end_openaudio;
 
         // realize the player
-        result = (*p->bqPlayerObject)->Realize(p->bqPlayerObject, SL_BOOLEAN_FALSE);
+        result = (*e->bqPlayerObject)->Realize(e->bqPlayerObject, SL_BOOLEAN_FALSE);
         if (result != SL_RESULT_SUCCESS) goto end_openaudio;
 
         // get the play interface
-        result = (*p->bqPlayerObject)->GetInterface(p->bqPlayerObject,
+        result = (*e->bqPlayerObject)->GetInterface(e->bqPlayerObject,
                                                     SL_IID_PLAY,
-                                                    &(p->bqPlayerPlay));
+                                                    &(e->bqPlayerPlay));
         if (result != SL_RESULT_SUCCESS) goto end_openaudio;
 
         // get the buffer queue interface
-        result = (*p->bqPlayerObject)->GetInterface(p->bqPlayerObject,
+        result = (*e->bqPlayerObject)->GetInterface(e->bqPlayerObject,
                                                     SL_IID_ANDROIDSIMPLEBUFFERQUEUE,
-                                                    &(p->bqPlayerBufferQueue));
+                                                    &(e->bqPlayerBufferQueue));
         if (result != SL_RESULT_SUCCESS) goto end_openaudio;
 
         // register callback on the buffer queue
         // The OpenSL API provides a callback mechanism for audio IO
-        // the callback is only use to signal the application, indicating that the
-        // buffer queue is ready to receive data.
-        result = (*p->bqPlayerBufferQueue)->RegisterCallback(p->bqPlayerBufferQueue,
+        // the callback mixes the next period into the buffer that was
+        // just played and enqueues it again.
+        result = (*e->bqPlayerBufferQueue)->RegisterCallback(e->bqPlayerBufferQueue,
                                                              bqPlayerCallback,
-                                                             p);
-        if (result != SL_RESULT_SUCCESS) goto end_openaudio;
-
-        // set the player's state to playing
-        result = (*p->bqPlayerPlay)->SetPlayState(p->bqPlayerPlay, SL_PLAYSTATE_PLAYING);
+                                                             e);
 
         end_openaudio:
         return result;
@@ -414,12 +552,12 @@ static SLresult openSLRecOpen(opensl_stream_t *p) {
         SLresult res;
 
         // Get the SL Engine Interface which is implicit
-        res = (*p->engineObject)->GetInterface(p->engineObject,
+        res = (*p->engine->engineObject)->GetInterface(p->engine->engineObject,
                                                SL_IID_ENGINE,
                                                (void*)&EngineItf);
 
         // Get the Audio IO DEVICE CAPABILITIES interface, which is also implicit
-        res = (*p->engineObject)->GetInterface(p->engineObject,
+        res = (*p->engine->engineObject)->GetInterface(p->engine->engineObject,
                                                         SL_IID_AUDIOIODEVICECAPABILITIES,
                                                         (void *) &AudioIODeviceCapabilitiesItf);
 
@@ -467,7 +605,7 @@ static SLresult openSLRecOpen(opensl_stream_t *p) {
         }
 
         // Get the optional DEVICE VOLUME interface from the engine
-        res = (*p->engineObject)->GetInterface(p->engineObject,
+        res = (*p->engine->engineObject)->GetInterface(p->engine->engineObject,
                                                SL_IID_DEVICEVOLUME,
                                                (void *) &devicevolumeItf);
 
@@ -519,7 +657,7 @@ static SLresult openSLRecOpen(opensl_stream_t *p) {
         // (requires the RECORD_AUDIO permission)
         const SLInterfaceID id[1] = {SL_IID_ANDROIDSIMPLEBUFFERQUEUE};
         const SLboolean req[1] = {SL_BOOLEAN_TRUE};
-        result = (*p->engineEngine)->CreateAudioRecorder(p->engineEngine,
+        result = (*p->engine->engineEngine)->CreateAudioRecorder(p->engine->engineEngine,
                                                          &(p->recorderObject),
                                                          &audioSource,
                                                          &audioSnk,
@@ -570,19 +708,157 @@ void bqRecorderCallback(SLAndroidSimpleBufferQueueItf bq, void *context) {
 }
 
 
-// this callback handler is called every time a buffer finishes playing
-//  it notifies our main processing thread that the buffer queue is ready
+// monotonic clock in us, modulo 2^32
+static uint32_t openSLClockUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+
+// this callback handler is called every time a buffer of the engine
+//  player finishes playing: the next period is mixed into it
 void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context) {
+    opensl_engine_t *e = (opensl_engine_t *) context;
+    short *buffer = e->mixBuffer[e->currentMixBuffer];
+
+    mixer_run(&e->mixer, buffer);
+    (*bq)->Enqueue(bq, buffer, e->bufferframes * MIXER_CHANNELS * sizeof(short));
+    e->currentMixBuffer = (e->currentMixBuffer + 1) % MIX_BUFFERS;
+}
+
+
+// called by the mixer every time an output buffer of a stream has been mixed
+//  it notifies our main processing thread that the buffer queue is ready
+void openSLOutputDone(void *context) {
     opensl_stream_t *p = (opensl_stream_t *) context;
+    p->outputPlayedUs.store(openSLClockUs(), std::memory_order_release);
+    p->outputPlayed.fetch_add(1, std::memory_order_release);
     notifyThreadLock(p->outlock);
 }
 
 
+/*
+Wait for the recorder to fill a buffer, hand the previous one back to
+the recorder and return the filled one.
+*/
+static short *openSLNextInputBuffer(opensl_stream_t *p) {
+    short *inBuffer = p->inputBuffer[p->currentInputBuffer];
+
+    waitThreadLock(p->inlock);
+
+    // Alex
+    if (p->captureTap) {
+        p->captureTap(p->captureContext, inBuffer, p->inBufSamples / p->inchannels);
+    }
+
+    (*p->recorderBufferQueue)->Enqueue(p->recorderBufferQueue,
+                                       inBuffer,
+                                       p->inBufSamples * sizeof(short));
+
+    p->currentInputBuffer = (p->currentInputBuffer ? 0 : 1);
+    return p->inputBuffer[p->currentInputBuffer];
+}
+
+
+/*
+Enqueue the current (full) output buffer to the mixer and move on to
+the next one, without waiting.
+*/
+static void openSLEnqueueOutputBuffer(opensl_stream_t *p) {
+    // the player ran dry: this buffer starts playing right away
+    if (p->outputQueued == p->outputPlayed.load(std::memory_order_acquire))
+        p->outputPlayedUs.store(openSLClockUs(), std::memory_order_release);
+
+    // counted first, so that its callback never sees more played than queued
+    p->outputQueued++;
+    mixer_enqueue(p->mixerInput, p->outputBuffer[p->currentOutputBuffer]);
+    p->currentOutputBuffer = (p->currentOutputBuffer + 1) % OUTPUT_BUFFERS;
+}
+
+
+/*
+Wait for the player to release a buffer, enqueue the current (full)
+output buffer and return the next one to fill.
+*/
+static short *openSLNextOutputBuffer(opensl_stream_t *p) {
+    waitThreadLock(p->outlock);
+    openSLEnqueueOutputBuffer(p);
+    return p->outputBuffer[p->currentOutputBuffer];
+}
+
+
+#ifdef DRIFT_COMPENSATION
+/*
+Frames enqueued to the player and not played yet. The play position
+inside the buffer at the head of the queue is interpolated from the
+time the previous one ended. *played is set to the frames played.
+*/
+static double openSLOutputPending(opensl_stream_t *p, double *played) {
+    int frames = p->outBufSamples / p->outchannels;
+    uint32_t n, us, queued;
+    double head = 0.;
+
+    do {
+        n = p->outputPlayed.load(std::memory_order_acquire);
+        us = p->outputPlayedUs.load(std::memory_order_acquire);
+    } while (n != p->outputPlayed.load(std::memory_order_acquire));
+
+    queued = p->outputQueued - n;
+    if (queued > 0) {
+        head = (double) (uint32_t) (openSLClockUs() - us) * 1e-6 * p->sample_rate;
+        if (head > frames) head = frames;
+    }
+
+    *played = (double) n * frames + head;
+    return (double) queued * frames - head;
+}
+#endif
+
+
+/*
+Process a block of frames from in (inchannels interleaved) to out
+(outchannels interleaved), applying the gain ramp. Channels are
+duplicated when there are more output than input channels.
+*/
+template <typename T>
+static void process_block(const T *in, int inchannels, T *out, int outchannels, int frames,
+                          gain_ramp_t gain) {
+    int i, c;
+    int32_t g = (int32_t) (gain.start * GAIN_UNITY);
+    int32_t step = (int32_t) ((gain.end - gain.start) * GAIN_UNITY) / frames;
+
+    if (gain.start == gain.end && g == 0) {
+        memset(out, 0, frames * outchannels * sizeof(T));
+        return;
+    }
+
+    if (gain.start == gain.end && g == GAIN_UNITY) {
+        if (inchannels == outchannels) {
+            memcpy(out, in, frames * inchannels * sizeof(T));
+        } else if (inchannels == 1 && outchannels == 2) {
+            for (i = 0; i < frames; i++)
+                out[2 * i] = out[2 * i + 1] = in[i];
+        } else {
+            for (i = 0; i < frames; i++)
+                for (c = 0; c < outchannels; c++)
+                    out[i * outchannels + c] = in[i * inchannels + c % inchannels];
+        }
+        return;
+    }
+
+    for (i = 0; i < frames; i++, g += step)
+        for (c = 0; c < outchannels; c++)
+            out[i * outchannels + c] = sample_traits<T>::mul(in[i * inchannels + c % inchannels], g);
+}
+
+
 /*
 Read a buffer from the OpenSL stream *p, of size samples.
 Returns the number of samples read.
 */
-int android_AudioIn(opensl_stream_t *p, float *buffer, int size) {
+template <typename T>
+int android_AudioIn(opensl_stream_t *p, T *buffer, int size) {
     short *inBuffer;
     int i, bufsamps = p->inBufSamples, index = p->currentInputIndex;
     if (bufsamps == 0) return 0;
@@ -592,21 +868,10 @@ int android_AudioIn(opensl_stream_t *p, float *buffer, int size) {
     // processing loop that calls the audio input function to get a block of samples
     for (i = 0; i < size; i++) {
         if (index >= bufsamps) {
-            waitThreadLock(p->inlock);
-            (*p->recorderBufferQueue)->Enqueue(p->recorderBufferQueue,
-                                               inBuffer,
-                                               bufsamps * sizeof(short));
-
-            // Alex
-            if (pcmFile) {
-                fwrite(inBuffer, bufsamps * sizeof(short), 1, pcmFile);
-            }
-
-            p->currentInputBuffer = (p->currentInputBuffer ? 0 : 1);
+            inBuffer = openSLNextInputBuffer(p);
             index = 0;
-            inBuffer = p->inputBuffer[p->currentInputBuffer];
         }
-        buffer[i] = (float) ((float) inBuffer[index++] * CONVMYFLT);
+        buffer[i] = sample_traits<T>::from16(inBuffer[index++]);
     }
     p->currentInputIndex = index;
     if (p->outchannels == 0)
@@ -619,7 +884,8 @@ int android_AudioIn(opensl_stream_t *p, float *buffer, int size) {
 Write a buffer to the OpenSL stream *p, of size samples.
 Returns the number of samples written.
 */
-int android_AudioOut(opensl_stream_t *p, float *buffer, int size) {
+template <typename T>
+int android_AudioOut(opensl_stream_t *p, const T *buffer, int size) {
 
     short *outBuffer;
     int i, bufsamps = p->outBufSamples, index = p->currentOutputIndex;
@@ -627,14 +893,10 @@ int android_AudioOut(opensl_stream_t *p, float *buffer, int size) {
     outBuffer = p->outputBuffer[p->currentOutputBuffer];
 
     for (i = 0; i < size; i++) {
-        outBuffer[index++] = (short) (buffer[i] * CONV16BIT);
+        outBuffer[index++] = sample_traits<T>::to16(buffer[i]);
         if (index >= p->outBufSamples) {
-            waitThreadLock(p->outlock);
-            (*p->bqPlayerBufferQueue)->Enqueue(p->bqPlayerBufferQueue,
-                                               outBuffer, bufsamps * sizeof(short));
-            p->currentOutputBuffer = (p->currentOutputBuffer ? 0 : 1);
+            outBuffer = openSLNextOutputBuffer(p);
             index = 0;
-            outBuffer = p->outputBuffer[p->currentOutputBuffer];
         }
     }
     p->currentOutputIndex = index;
@@ -643,6 +905,212 @@ int android_AudioOut(opensl_stream_t *p, float *buffer, int size) {
 }
 
 
+/*
+Move one whole device buffer from the recorder to the player of the
+stream *p, calling process(in, out, frames) directly from the capture
+buffer into the player buffer. Only for 16 bit pipelines, and not to be
+mixed with android_AudioIn/android_AudioOut on the same stream. The
+capture and process stages are marked on load.
+Returns the number of frames passed through.
+*/
+template <typename Proc>
+int android_AudioThrough(opensl_stream_t *p, dsp_load_meter_t *load, Proc process) {
+    short *inBuffer, *outBuffer;
+    int frames;
+
+    if (p->inBufSamples == 0 || p->outBufSamples == 0) return 0;
+    frames = p->inBufSamples / p->inchannels;
+
+    inBuffer = openSLNextInputBuffer(p);
+    outBuffer = p->outputBuffer[p->currentOutputBuffer];
+    dsp_load_mark(load, LOAD_CAPTURE);
+
+    process(inBuffer, outBuffer, frames);
+    dsp_load_mark(load, LOAD_PROCESS);
+    openSLNextOutputBuffer(p);
+
+    p->time += (double) frames / p->sample_rate;
+    return frames;
+}
+
+
+#ifdef DRIFT_COMPENSATION
+/*
+Same as android_AudioThrough, with the capture and playback clocks
+decoupled by the drift compensation *d: the capture buffer is resampled
+into its FIFO, and process(in, out, frames) runs from the FIFO into as
+many player buffers as its latency target allows. Paced by the recorder
+only, it never waits for the player, whose underruns are concealed by
+the mixer; p->time follows the playback clock. Resampling counts as
+capture on load, and all the player buffers filled as processing.
+Returns the number of frames captured.
+*/
+template <typename Proc>
+int android_AudioThroughDrift(opensl_stream_t *p, drift_comp_t *d, dsp_load_meter_t *load,
+                              Proc process) {
+    short *inBuffer;
+    double pending, played;
+    int frames;
+
+    if (p->inBufSamples == 0 || p->outBufSamples == 0) return 0;
+    frames = p->inBufSamples / p->inchannels;
+
+    inBuffer = openSLNextInputBuffer(p);
+    drift_resample(d, inBuffer, frames);
+    dsp_load_mark(load, LOAD_CAPTURE);
+
+    while (p->outputQueued - p->outputPlayed.load(std::memory_order_acquire) <
+           (uint32_t) d->target_blocks && d->fifo_fill >= frames) {
+        process(d->fifo, p->outputBuffer[p->currentOutputBuffer], frames);
+        drift_fifo_drop(d, frames);
+        openSLEnqueueOutputBuffer(p);
+    }
+
+    pending = openSLOutputPending(p, &played);
+    drift_update(d, d->fifo_fill + pending);
+    dsp_load_mark(load, LOAD_PROCESS);
+
+    p->time = played / p->sample_rate;
+    return frames;
+}
+#endif
+
+
+/*
+Processing loop, selected at compile time from the sample type:
+16 bit goes buffer to buffer through android_AudioThrough, any other
+type is converted into a local vector, processed and converted back.
+Returns the number of input frames processed.
+*/
+template <typename T, bool native = sample_traits<T>::native>
+struct pipeline;
+
+template <typename T>
+struct pipeline<T, true> {
+    static long run(opensl_stream_t *p, audio_session_t *s) {
+        control_state_t state;
+        long frames = 0;
+        int block;
+#ifdef DRIFT_COMPENSATION
+        drift_comp_t drift;
+
+        if (drift_init(&drift, p->inchannels, p->inBufSamples / p->inchannels,
+                       s->jitter_blocks) < 0)
+            return 0;
+#endif
+
+        control_init(&state, &s->controls, p->sample_rate);
+        dsp_load_reset(&s->load, p->sample_rate);
+
+        while (s->on) {
+            auto process = [&](const short *in, short *out, int n) {
+                process_block(in, p->inchannels, out, p->outchannels, n,
+                              control_begin_block(&state, &s->controls, n));
+            };
+#ifdef DRIFT_COMPENSATION
+            block = android_AudioThroughDrift(p, &drift, &s->load, process);
+            s->drift_ppm.store((float) drift.ppm, std::memory_order_relaxed);
+#else
+            block = android_AudioThrough(p, &s->load, process);
+#endif
+            dsp_load_mark(&s->load, LOAD_PLAYBACK);
+            dsp_load_end(&s->load, block);
+            frames += block;
+        }
+
+#ifdef DRIFT_COMPENSATION
+        drift_free(&drift);
+#endif
+        return frames;
+    }
+};
+
+template <typename T>
+struct pipeline<T, false> {
+    static long run(opensl_stream_t *p, audio_session_t *s) {
+        T inbuffer[VECSAMPS_MONO], outbuffer[VECSAMPS_STEREO];
+        control_state_t state;
+        int samps, frames;
+        long total = 0;
+
+        control_init(&state, &s->controls, p->sample_rate);
+        dsp_load_reset(&s->load, p->sample_rate);
+
+        while (s->on) {
+            samps = android_AudioIn(p, inbuffer, VECSAMPS_MONO);
+            frames = samps / p->inchannels;
+            dsp_load_mark(&s->load, LOAD_CAPTURE);
+            process_block(inbuffer, p->inchannels, outbuffer, p->outchannels, frames,
+                          control_begin_block(&state, &s->controls, frames));
+            dsp_load_mark(&s->load, LOAD_PROCESS);
+            android_AudioOut(p, outbuffer, frames * p->outchannels);
+            dsp_load_mark(&s->load, LOAD_PLAYBACK);
+            dsp_load_end(&s->load, frames);
+            total += frames;
+        }
+        return total;
+    }
+};
+
+
+/*
+Capture only stream: wait for each recorder buffer, which the capture
+tap records and exports. Returns the number of frames captured.
+*/
+static long capture_run(opensl_stream_t *p, audio_session_t *s) {
+    int frames = p->inBufSamples / p->inchannels;
+    long total = 0;
+
+    dsp_load_reset(&s->load, p->sample_rate);
+
+    while (s->on) {
+        openSLNextInputBuffer(p);
+        dsp_load_mark(&s->load, LOAD_CAPTURE);
+        dsp_load_end(&s->load, frames);
+        p->time += (double) frames / p->sample_rate;
+        total += frames;
+    }
+    return total;
+}
+
+
+/*
+Playback only stream: play the mapped file *source over and over, with
+the gain, mute and monitor controls of the session, waiting for the
+mixer to release each buffer before the next one. Reading the file
+counts as capture on the load meter.
+Returns the number of frames played.
+*/
+static long playback_run(opensl_stream_t *p, audio_session_t *s, const wav_map_t *source) {
+    control_state_t state;
+    int frames = p->outBufSamples / p->outchannels, done, n;
+    long total = 0, pos = 0;
+    short *out;
+
+    control_init(&state, &s->controls, p->sample_rate);
+    dsp_load_reset(&s->load, p->sample_rate);
+
+    while (s->on) {
+        out = p->outputBuffer[p->currentOutputBuffer];
+        for (done = 0; done < frames; done += n) {
+            n = source->frames - pos < frames - done ? (int) (source->frames - pos) : frames - done;
+            process_block(source->samples + pos * source->channels, source->channels,
+                          out + done * p->outchannels, p->outchannels, n,
+                          control_begin_block(&state, &s->controls, n));
+            if ((pos += n) == source->frames)
+                pos = 0;
+        }
+        dsp_load_mark(&s->load, LOAD_CAPTURE);
+        openSLNextOutputBuffer(p);
+        dsp_load_mark(&s->load, LOAD_PLAYBACK);
+        dsp_load_end(&s->load, frames);
+        p->time += (double) frames / p->sample_rate;
+        total += frames;
+    }
+    return total;
+}
+
+
 
 
 //----------------------------------------------------------------------
@@ -705,79 +1173,173 @@ void destroyThreadLock(void *lock) {
 
 
 
-//Writes a header to a file that has been opened (take heed that the correct flags
-//must've been used. Binary mode required, then you should choose whether you want to
-//append or overwrite current file
-void write_wav_header(long samples, short channels){
-    struct wavfile filler;
+//----------------------------------------------------------------
+// the exported functions
 
-    short short_value;
+// writes what the session captures to its recorder and export ring
+static void sessionCapture(void *context, const short *buffer, int frames) {
+    audio_session_t *s = (audio_session_t *) context;
 
-    strcpy(filler.id, "RIFF");
-    filler.totallength = (samples * channels) + sizeof(struct wavfile) - 8; //81956
-    strcpy(filler.wavefmt, "WAVEfmt ");
-    filler.format = 16;
-    filler.pcm = 1;
-    filler.channels = channels;
-    filler.frequency = SAMPLE_RATE;
-    filler.bits_per_sample = 16;
-    filler.bytes_per_second = filler.channels * filler.frequency * filler.bits_per_sample/8;
-    filler.bytes_by_capture = filler.channels * filler.bits_per_sample / 8;
-    filler.bytes_in_data = samples * filler.channels * filler.bits_per_sample/8;
-    strcpy(filler.data, "data");
+    if (s->recorder) {
+        segment_recorder_write(s->recorder, buffer, frames);
+    }
 
-    FILE* pcmFile = fopen("/sdcard/rawFile.pcm", "rb");
-    FILE* wavFile = fopen("/sdcard/rawFile.wav", "wb");
+    if (s->exporter) {
+        shm_export_write(s->exporter, buffer, frames);
+    }
+}
 
-    //write header
-    fwrite(&filler, 1, sizeof(filler), wavFile);
 
-    int i;
-    // copy the file
-    for (i=0; i<samples; i++) {
-        fread(&short_value, 2, 1, pcmFile);
-        fwrite(&short_value, 2, 1, wavFile);
-    }
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-    fclose(wavFile);
-    fclose(pcmFile);
+/*
+ * Create the audio engine of the process, shared by all the sessions.
+ * Returns its handle, 0 if it cannot be created.
+ */
+JNIEXPORT jlong JNICALL
+Java_com_example_alex_testaudio_MainActivity_openengine(JNIEnv *env, jobject thiz) {
+    return (jlong) (intptr_t) android_OpenAudioEngine(SAMPLE_RATE, BUFFERFRAMES);
 }
 
 
-//----------------------------------------------------------------
-// the exported functions
+// once all its sessions are closed
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_closeengine(JNIEnv *env, jobject thiz, jlong engine) {
+    android_CloseAudioEngine((opensl_engine_t *) (intptr_t) engine);
+}
+
+
+/*
+ * Create a session on the engine, which startprocess runs: a stream of
+ * inchannels (0 to 2) captured channels and outchannels (0, 1 or 2)
+ * played ones, not both 0. Streams with outputs run at the engine rate.
+ * Several sessions can run at the same time, their outputs are mixed.
+ * Playback only ones play the file set with setsource.
+ * Returns its handle, 0 if it cannot be created.
+ */
+JNIEXPORT jlong JNICALL
+Java_com_example_alex_testaudio_MainActivity_opensession(JNIEnv *env, jobject thiz, jlong engine,
+                                                         jint sample_rate, jint inchannels,
+                                                         jint outchannels) {
+    opensl_engine_t *e = (opensl_engine_t *) (intptr_t) engine;
+    audio_session_t *s;
+
+    if (e == NULL || sample_rate <= 0 || inchannels < 0 || inchannels > DRIFT_MAX_CHANNELS
+        || (outchannels != 0 && outchannels != 1 && outchannels != MIXER_CHANNELS)
+        || (inchannels == 0 && outchannels == 0)
+        || (outchannels != 0 && sample_rate != e->sample_rate))
+        return 0;
+
+    if ((s = new (std::nothrow) audio_session_t()) == NULL)
+        return 0;
+
+    s->engine = e;
+    s->sample_rate = sample_rate;
+    s->inchannels = inchannels;
+    s->outchannels = outchannels;
+    snprintf(s->record_dir, sizeof(s->record_dir), "/sdcard");
+    snprintf(s->record_prefix, sizeof(s->record_prefix), "rawFile");
+    s->record_segment_seconds = 60.;
+    s->jitter_blocks = DRIFT_TARGET_BLOCKS;
+    s->export_fd = -1;
+    return (jlong) (intptr_t) s;
+}
+
+
+// a session can be closed once its startprocess has returned. The session
+// functions below do nothing on a 0 handle, the getters return their idle
+// values.
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_closesession(JNIEnv *env, jobject thiz, jlong session) {
+    delete (audio_session_t *) (intptr_t) session;
+}
+
+
+/*
+ * Start/stop protocol: armprocess, on the calling thread, before starting
+ * the thread that runs startprocess; stopprocess, from any thread, ends it.
+ * startprocess only reads the flag, so a stopprocess that comes while it
+ * is still opening the stream is not lost: it returns as soon as it sees
+ * it, without running the loop, or right away if it came before.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_armprocess(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->on = 1;
+}
 
-static int on;
 
 JNIEXPORT void JNICALL
-Java_com_example_alex_testaudio_MainActivity_startprocess() {
+Java_com_example_alex_testaudio_MainActivity_startprocess(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
     opensl_stream_t *p;
-    int samps, i, j;
-    float inbuffer[VECSAMPS_MONO], outbuffer[VECSAMPS_STEREO];
-    pcmFile = fopen("/sdcard/rawFile.pcm", "wb");
+    wav_map_t source;
+    int depth;
 
-    p = android_OpenAudioDevice(SAMPLE_RATE, 1, 2, BUFFERFRAMES);
+    if (s == NULL || !s->on)
+        return;
 
-    if (p == NULL) return;
+    // playback only: the file set with setsource, at the session rate
+    memset(&source, 0, sizeof(source));
+    if (s->inchannels == 0 &&
+        (wav_map_open(s->source_path, &source) != 0 || source.frames == 0
+         || source.sample_rate != s->sample_rate)) {
+        wav_map_close(&source);
+        return;
+    }
 
-    on = 1;
-    long total_samples = 0;
+    // what is captured is recorded, and exported if asked to
+    if (s->inchannels) {
+        s->recorder = segment_recorder_open(s->record_dir, s->record_prefix, s->sample_rate,
+                                            s->inchannels, s->record_segment_seconds);
 
-8    while (on) {
-        samps = android_AudioIn(p, inbuffer, VECSAMPS_MONO);
-        for (i = 0, j = 0; i < samps; i++, j += 2) {
-            outbuffer[j] = outbuffer[j + 1] = inbuffer[i];
-            total_samples += samps;
-        }
+        if (s->export_enabled &&
+            (s->exporter = shm_export_open(s->sample_rate, s->inchannels, BUFFERFRAMES)) != NULL)
+            s->export_fd = s->exporter->fd;
+    }
 
-        android_AudioOut(p, outbuffer, samps * 2);
+    s->jitter.underruns = 0;
+    s->jitter.concealed = 0;
+    s->jitter.realigned = 0;
+
+    // the drift compensated loop keeps as many player buffers queued as its
+    // latency target allows, the others one at a time
+    depth = BUFFERFRAMES;
+#ifdef DRIFT_COMPENSATION
+    if (s->inchannels && s->outchannels)
+        depth = (int) drift_target_blocks(s->jitter_blocks) * BUFFERFRAMES;
+#endif
 
+    p = android_OpenAudioDevice(s->engine, s->sample_rate, s->inchannels, s->outchannels,
+                                BUFFERFRAMES, depth, &s->jitter);
+
+    if (p != NULL) {
+        p->captureTap = sessionCapture;
+        p->captureContext = s;
+        // unless stopped while the stream was opening
+        if (s->on) {
+            if (s->inchannels && s->outchannels)
+                pipeline<pipeline_sample_t>::run(p, s);
+            else if (s->inchannels)
+                capture_run(p, s);
+            else
+                playback_run(p, s, &source);
+        }
+        android_CloseAudioDevice(p);
     }
 
-    android_CloseAudioDevice(p);
-    fclose(pcmFile);
+    wav_map_close(&source);
+
+    s->export_fd = -1;
+    shm_export_close(s->exporter);
+    s->exporter = NULL;
 
-    write_wav_header(total_samples, 2);
+    segment_recorder_close(s->recorder);
+    s->recorder = NULL;
 
 }
 
@@ -785,11 +1347,234 @@ Java_com_example_alex_testaudio_MainActivity_startprocess() {
 
 
 JNIEXPORT void JNICALL
-Java_com_example_alex_testaudio_MainActivity_stopprocess() {
-    on = 0;
+Java_com_example_alex_testaudio_MainActivity_stopprocess(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->on = 0;
+}
+
+
+// the control parameters can be changed at any time, also while the
+// processing loop runs; they are picked up at the next block
+
+// snap: jump to the new gain instead of smoothing towards it
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setgain(JNIEnv *env, jobject thiz, jlong session,
+                                                     jfloat gain, jboolean snap) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+    control_command_t cmd = {CONTROL_SNAP, 0.f};
+
+    if (s == NULL)
+        return;
+
+    s->controls.gain.store(gain, std::memory_order_relaxed);
+    if (snap)
+        s->controls.commands.push(cmd);
+}
+
+
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setmute(JNIEnv *env, jobject thiz, jlong session,
+                                                     jboolean mute) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->controls.mute.store(mute != 0, std::memory_order_relaxed);
+}
+
+
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setmonitor(JNIEnv *env, jobject thiz, jlong session,
+                                                        jboolean monitor) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->controls.monitor.store(monitor != 0, std::memory_order_relaxed);
+}
+
+
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setsmoothing(JNIEnv *env, jobject thiz, jlong session,
+                                                          jfloat ms) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->controls.smoothing_ms.store(ms > 0.f ? ms : 0.f, std::memory_order_relaxed);
+}
+
+
+/*
+ * Where and how to record: <dir>/<prefix>-NNNNN.wav segments of
+ * segment_seconds each, plus the <dir>/<prefix>.idx seek index. A prefix
+ * that already has an index is not recorded to, use a new one each time.
+ * Takes effect at the next startprocess.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setrecording(JNIEnv *env, jobject thiz, jlong session,
+                                                          jstring dir, jstring prefix,
+                                                          jfloat segment_seconds) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+    const char *d, *n;
+
+    if (s == NULL)
+        return;
+
+    d = env->GetStringUTFChars(dir, NULL);
+    n = env->GetStringUTFChars(prefix, NULL);
+    snprintf(s->record_dir, sizeof(s->record_dir), "%s", d);
+    snprintf(s->record_prefix, sizeof(s->record_prefix), "%s", n);
+    s->record_segment_seconds = segment_seconds;
+
+    env->ReleaseStringUTFChars(dir, d);
+    env->ReleaseStringUTFChars(prefix, n);
+}
+
+
+/*
+ * What a playback only session plays: the 16 bit WAV file at path, over
+ * and over, from the next startprocess on. Its rate must be the session
+ * rate, its channels are mapped to the session outputs like the captured
+ * ones. Without one, startprocess returns at once.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setsource(JNIEnv *env, jobject thiz, jlong session,
+                                                       jstring path) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+    const char *f;
+
+    if (s == NULL)
+        return;
+
+    f = env->GetStringUTFChars(path, NULL);
+    snprintf(s->source_path, sizeof(s->source_path), "%s", f);
+    env->ReleaseStringUTFChars(path, f);
+}
+
+
+/*
+ * Build the waveform overview <dir>/<prefix>.peaksK of an existing WAV
+ * file, the same as the recorder writes while recording.
+ * Returns false if the file cannot be read or the overview written.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_example_alex_testaudio_MainActivity_makepeaks(JNIEnv *env, jobject thiz, jstring wav,
+                                                       jstring dir, jstring prefix) {
+    const char *w = env->GetStringUTFChars(wav, NULL);
+    const char *d = env->GetStringUTFChars(dir, NULL);
+    const char *n = env->GetStringUTFChars(prefix, NULL);
+    int result = peak_overview_generate(w, d, n);
+
+    env->ReleaseStringUTFChars(wav, w);
+    env->ReleaseStringUTFChars(dir, d);
+    env->ReleaseStringUTFChars(prefix, n);
+    return (jboolean) (result == 0);
+}
+
+
+/*
+ * Publish the captured stream in a shared memory ring (see shm-export.h)
+ * from the next startprocess on.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setexport(JNIEnv *env, jobject thiz, jlong session,
+                                                       jboolean enabled) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->export_enabled = enabled != 0;
+}
+
+
+/*
+ * Descriptor of the export ring while the stream runs, -1 otherwise.
+ * Readers in other processes get it dup'ed, e.g. in a ParcelFileDescriptor.
+ */
+JNIEXPORT jint JNICALL
+Java_com_example_alex_testaudio_MainActivity_getexportfd(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    return s != NULL ? s->export_fd.load() : -1;
+}
+
+
+/*
+ * DSP load of the processing loop, as fractions of the buffer period:
+ * for each stage (capture, process, playback, total) the cpu average,
+ * p99 and max, then the wall clock average, p99 and max.
+ */
+JNIEXPORT jfloatArray JNICALL
+Java_com_example_alex_testaudio_MainActivity_getload(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+    dsp_load_report_t report[LOAD_STAGES];
+    jfloatArray result;
+
+    static_assert(sizeof(dsp_load_report_t) == 6 * sizeof(jfloat), "report is read as a float array");
+
+    if (s != NULL)
+        dsp_load_read(&s->load, report);
+    else
+        memset(report, 0, sizeof(report));
+
+    result = env->NewFloatArray(LOAD_STAGES * 6);
+    if (result != NULL)
+        env->SetFloatArrayRegion(result, 0, LOAD_STAGES * 6, (const jfloat *) report);
+    return result;
+}
+
+
+/*
+ * Output buffering, in blocks of the monitor path: the player buffers
+ * kept queued plus a reserve (1.5 to 3.5, default 3.5). Less buffering
+ * means less latency and more concealed underruns, see getjitter.
+ * Takes effect at the next startprocess, with DRIFT_COMPENSATION only.
+ */
+JNIEXPORT void JNICALL
+Java_com_example_alex_testaudio_MainActivity_setjitter(JNIEnv *env, jobject thiz, jlong session,
+                                                       jfloat blocks) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    if (s != NULL)
+        s->jitter_blocks = blocks;
+}
+
+
+/*
+ * Output underruns since startprocess: the number of dropouts, the
+ * frames concealed for them and the late frames dropped afterwards to
+ * bring the latency back.
+ */
+JNIEXPORT jintArray JNICALL
+Java_com_example_alex_testaudio_MainActivity_getjitter(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+    jint values[3] = {0, 0, 0};
+    jintArray result;
+
+    if (s != NULL) {
+        values[0] = (jint) s->jitter.underruns.load(std::memory_order_relaxed);
+        values[1] = (jint) s->jitter.concealed.load(std::memory_order_relaxed);
+        values[2] = (jint) s->jitter.realigned.load(std::memory_order_relaxed);
+    }
+
+    result = env->NewIntArray(3);
+    if (result != NULL)
+        env->SetIntArrayRegion(result, 0, 3, values);
+    return result;
+}
+
+
+/*
+ * Measured drift of the capture clock against the playback clock, in
+ * ppm, positive when capture runs fast. 0 without DRIFT_COMPENSATION.
+ */
+JNIEXPORT jfloat JNICALL
+Java_com_example_alex_testaudio_MainActivity_getdrift(JNIEnv *env, jobject thiz, jlong session) {
+    audio_session_t *s = (audio_session_t *) (intptr_t) session;
+
+    return s != NULL ? s->drift_ppm.load(std::memory_order_relaxed) : 0.f;
 }
 
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
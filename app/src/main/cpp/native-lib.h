@@ -2,12 +2,22 @@
 // Created by alex on 26/12/16.
 //
 
+#include <atomic>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include "audio-mixer.h"
 
 #ifndef TESTAUDIO_NATIVE_LIB_H
 #define TESTAUDIO_NATIVE_LIB_H
 
+// player buffers of a stream: the queue is deep enough for the drift
+// compensated loop, which keeps up to 3 of them in flight
+#define OUTPUT_BUFFERS 3
+
+// buffers of the engine player, which plays the mix of all the streams
+#define MIX_BUFFERS 2
+
 typedef struct threadLock_{
     pthread_mutex_t m;
     pthread_cond_t  c;
@@ -15,7 +25,9 @@ typedef struct threadLock_{
 } threadLock;
 
 
-typedef struct opensl_stream {
+// the OpenSL engine, shared by all the streams of the process, and the
+// player their outputs are mixed into
+typedef struct opensl_engine {
 
     // engine interfaces
     SLObjectItf engineObject;
@@ -30,6 +42,28 @@ typedef struct opensl_stream {
     SLAndroidSimpleBufferQueueItf bqPlayerBufferQueue;
     SLEffectSendItf bqPlayerEffectSend;
 
+    // mix of the output streams, MIXER_CHANNELS channels
+    audio_mixer_t mixer;
+    short *mixBuffer[MIX_BUFFERS];
+    int currentMixBuffer;
+
+    // output streams open; the player only plays while there are some
+    pthread_mutex_t lock;
+    int outputs;
+
+    int sample_rate;
+    int bufferframes;
+
+} opensl_engine_t;
+
+
+// called with each filled capture buffer, before it goes back to the recorder
+typedef void (*opensl_capture_tap)(void *context, const short *buffer, int frames);
+
+typedef struct opensl_stream {
+
+    opensl_engine_t *engine;
+
     // recorder interfaces
     SLObjectItf recorderObject;
     SLRecordItf recorderRecord;
@@ -39,14 +73,24 @@ typedef struct opensl_stream {
     int currentInputIndex;
     int currentOutputIndex;
 
-    // current buffer half (0, 1)
+    // current buffer (0 .. OUTPUT_BUFFERS - 1 for output, 0, 1 for input)
     int currentOutputBuffer;
     int currentInputBuffer;
 
     // buffers
-    short *outputBuffer[2];
+    short *outputBuffer[OUTPUT_BUFFERS];
     short *inputBuffer[2];
 
+    // output to the engine mixer
+    mixer_input_t *mixerInput;
+
+    // player position: buffers enqueued (processing thread), buffers
+    // played and the monotonic time in us the last one ended, modulo
+    // 2^32 (mixer)
+    uint32_t outputQueued;
+    std::atomic<uint32_t> outputPlayed;
+    std::atomic<uint32_t> outputPlayedUs;
+
     // size of buffers
     int outBufSamples;
     int inBufSamples;
@@ -55,6 +99,9 @@ typedef struct opensl_stream {
     void*  inlock;
     void*  outlock;
 
+    opensl_capture_tap captureTap;
+    void *captureContext;
+
     double time;
     int inchannels;
     int outchannels;
@@ -62,21 +109,4 @@ typedef struct opensl_stream {
 
 } opensl_stream_t;
 
-struct wavfile
-{
-    char        id[4];          // should always contain "RIFF"
-    int     totallength;    // total file length minus 8
-    char        wavefmt[8];     // should be "WAVEfmt "
-    int     format;         // 16 for PCM format
-    short     pcm;            // 1 for PCM format
-    short     channels;       // channels
-    int     frequency;      // sampling frequency, 16000 in this case
-    int     bytes_per_second;
-    short     bytes_by_capture;
-    short     bits_per_sample;
-    char        data[4];        // should always contain "data"
-    int     bytes_in_data;
-};
-
-
 #endif //TESTAUDIO_NATIVE_LIB_H
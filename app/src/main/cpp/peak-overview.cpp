@@ -0,0 +1,282 @@
+//
+// Waveform overview
+//
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peak-overview.h"
+#include "wav-file.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PEAK_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PEAK_SSE2 1
+#endif
+
+// frames handed to peak_writer_add at once by the offline generator
+#define PEAK_CHUNK (1 << 20)
+
+
+void peak_accum_reset(peak_accum_t *a) {
+    a->min = INT16_MAX;
+    a->max = INT16_MIN;
+    a->sumsq = 0;
+    a->count = 0;
+}
+
+
+/*
+ * Add n samples to the reduction: 8 samples at a time with NEON or SSE2
+ * where available, the tail (and other targets) in plain C.
+ */
+void peak_reduce(const int16_t *samples, int n, peak_accum_t *a) {
+    int i = 0;
+    int32_t mn = a->min, mx = a->max;
+    int64_t sumsq = 0;
+
+#if defined(PEAK_NEON)
+    if (n >= 8) {
+        int16x8_t vmin = vdupq_n_s16(INT16_MAX), vmax = vdupq_n_s16(INT16_MIN);
+        int64x2_t vsum = vdupq_n_s64(0);
+        int16_t lanes[8];
+        int64_t sums[2];
+        int k;
+
+        for (; i + 8 <= n; i += 8) {
+            int16x8_t v = vld1q_s16(samples + i);
+            vmin = vminq_s16(vmin, v);
+            vmax = vmaxq_s16(vmax, v);
+            vsum = vpadalq_s32(vsum, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+            vsum = vpadalq_s32(vsum, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+        }
+
+        vst1q_s16(lanes, vmin);
+        for (k = 0; k < 8; k++) if (lanes[k] < mn) mn = lanes[k];
+        vst1q_s16(lanes, vmax);
+        for (k = 0; k < 8; k++) if (lanes[k] > mx) mx = lanes[k];
+        vst1q_s64(sums, vsum);
+        sumsq += sums[0] + sums[1];
+    }
+#elif defined(PEAK_SSE2)
+    if (n >= 8) {
+        __m128i vmin = _mm_set1_epi16(INT16_MAX), vmax = _mm_set1_epi16(INT16_MIN);
+        __m128i vsum = _mm_setzero_si128(), zero = _mm_setzero_si128();
+        int16_t lanes[8];
+        int64_t sums[2];
+        int k;
+
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (samples + i));
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            // pairs of squares, up to 2^31: widened as unsigned
+            __m128i sq = _mm_madd_epi16(v, v);
+            vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(sq, zero));
+            vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(sq, zero));
+        }
+
+        _mm_storeu_si128((__m128i *) lanes, vmin);
+        for (k = 0; k < 8; k++) if (lanes[k] < mn) mn = lanes[k];
+        _mm_storeu_si128((__m128i *) lanes, vmax);
+        for (k = 0; k < 8; k++) if (lanes[k] > mx) mx = lanes[k];
+        _mm_storeu_si128((__m128i *) sums, vsum);
+        sumsq += sums[0] + sums[1];
+    }
+#endif
+
+    for (; i < n; i++) {
+        int32_t s = samples[i];
+        if (s < mn) mn = s;
+        if (s > mx) mx = s;
+        sumsq += s * s;
+    }
+
+    a->min = mn;
+    a->max = mx;
+    a->sumsq += sumsq;
+    a->count += n;
+}
+
+
+static void peak_accum_merge(peak_accum_t *to, const peak_accum_t *from) {
+    if (from->min < to->min) to->min = from->min;
+    if (from->max > to->max) to->max = from->max;
+    to->sumsq += from->sumsq;
+    to->count += from->count;
+}
+
+
+// write the entries of all the channels of level
+static void peak_write(peak_writer_t *w, int level) {
+    peak_entry_t e[PEAK_MAX_CHANNELS];
+    peak_accum_t *a;
+    double rms;
+    int c;
+
+    for (c = 0; c < w->channels; c++) {
+        a = &w->acc[level][c];
+        rms = sqrt((double) a->sumsq / (double) a->count);
+        e[c].min = (int16_t) a->min;
+        e[c].max = (int16_t) a->max;
+        e[c].rms = (int16_t) (rms > INT16_MAX ? INT16_MAX : rms);    // 32768 for a run of -32768
+        e[c].reserved = 0;
+    }
+    if (w->files[level] != NULL)
+        fwrite(e, sizeof(e[0]), (size_t) w->channels, w->files[level]);
+}
+
+
+static void peak_carry(peak_writer_t *w, int level) {
+    int c;
+
+    for (c = 0; c < w->channels; c++)
+        peak_accum_merge(&w->acc[level + 1][c], &w->acc[level][c]);
+}
+
+
+// write the complete entry of level, and carry it over to the level above
+static void peak_emit(peak_writer_t *w, int level) {
+    int c;
+
+    peak_write(w, level);
+
+    if (level + 1 < PEAK_LEVELS) {
+        peak_carry(w, level);
+        if (++w->parts[level + 1] == PEAK_RATIO)
+            peak_emit(w, level + 1);
+    }
+
+    for (c = 0; c < w->channels; c++)
+        peak_accum_reset(&w->acc[level][c]);
+    w->parts[level] = 0;
+}
+
+
+/*
+ * Create the overview files <dir>/<prefix>.peaks0 .. peaksN of a stream
+ * of 1 to PEAK_MAX_CHANNELS channels.
+ * Returns NULL if none of them can be created.
+ */
+peak_writer_t *peak_writer_open(const char *dir, const char *prefix, int sample_rate, int channels) {
+    peak_writer_t *w;
+    peak_file_header_t header;
+    char path[PATH_MAX];
+    int k, c, n, opened = 0, decimation = PEAK_BASE;
+
+    if (channels < 1 || channels > PEAK_MAX_CHANNELS)
+        return NULL;
+
+    w = (peak_writer_t *) calloc(sizeof(peak_writer_t), (size_t) 1);
+    if (w == NULL)
+        return NULL;
+
+    w->channels = channels;
+
+    for (k = 0; k < PEAK_LEVELS; k++, decimation *= PEAK_RATIO) {
+        for (c = 0; c < channels; c++)
+            peak_accum_reset(&w->acc[k][c]);
+
+        // a level whose path does not fit is skipped, not opened truncated
+        n = snprintf(path, sizeof(path), "%s/%s.peaks%d", dir, prefix, k);
+        if (n < 0 || (size_t) n >= sizeof(path) || (w->files[k] = fopen(path, "wb")) == NULL)
+            continue;
+
+        memcpy(header.id, "TAPK", 4);
+        header.version = PEAK_VERSION;
+        header.sample_rate = sample_rate;
+        header.channels = channels;
+        header.level = k;
+        header.decimation = decimation;
+        fwrite(&header, sizeof(header), 1, w->files[k]);
+        opened++;
+    }
+
+    if (opened == 0) {
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+
+// add frames interleaved frames to the overview
+void peak_writer_add(peak_writer_t *w, const short *samples, int frames) {
+    int16_t channel[PEAK_BASE];
+    int n, c, i;
+
+    while (frames > 0) {
+        n = PEAK_BASE - w->parts[0];
+        if (n > frames) n = frames;
+
+        if (w->channels == 1) {
+            peak_reduce(samples, n, &w->acc[0][0]);
+        } else {
+            // each channel on its own, gathered for the kernel
+            for (c = 0; c < w->channels; c++) {
+                for (i = 0; i < n; i++)
+                    channel[i] = samples[i * w->channels + c];
+                peak_reduce(channel, n, &w->acc[0][c]);
+            }
+        }
+        w->parts[0] += n;
+        samples += n * w->channels;
+        frames -= n;
+
+        if (w->parts[0] == PEAK_BASE)
+            peak_emit(w, 0);
+    }
+}
+
+
+// write out the partial last entries and close the files
+void peak_writer_close(peak_writer_t *w) {
+    int k;
+
+    if (w == NULL)
+        return;
+
+    // partial entries, each merged into the level above before that one is written
+    for (k = 0; k < PEAK_LEVELS; k++) {
+        if (w->acc[k][0].count > 0) {
+            peak_write(w, k);
+            if (k + 1 < PEAK_LEVELS)
+                peak_carry(w, k);
+        }
+        if (w->files[k] != NULL)
+            fclose(w->files[k]);
+    }
+    free(w);
+}
+
+
+/*
+ * Build the overview of an existing 16 bit WAV file, with the same
+ * kernels as the recorder, reading it through a memory mapping.
+ * Returns 0, or -1 on error, more than PEAK_MAX_CHANNELS channels included.
+ */
+int peak_overview_generate(const char *wav_path, const char *dir, const char *prefix) {
+    wav_map_t m;
+    peak_writer_t *w;
+    long frames;
+    int n;
+
+    if (wav_map_open(wav_path, &m) != 0)
+        return -1;
+
+    if ((w = peak_writer_open(dir, prefix, m.sample_rate, m.channels)) == NULL) {
+        wav_map_close(&m);
+        return -1;
+    }
+
+    for (frames = 0; frames < m.frames; frames += n) {
+        n = m.frames - frames < PEAK_CHUNK ? (int) (m.frames - frames) : PEAK_CHUNK;
+        peak_writer_add(w, m.samples + frames * m.channels, n);
+    }
+    peak_writer_close(w);
+    wav_map_close(&m);
+    return 0;
+}
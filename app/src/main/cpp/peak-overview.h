@@ -0,0 +1,67 @@
+//
+// Waveform overview: min, max and RMS of the recording at several
+// decimation levels, so that any zoom level can be drawn by reading a
+// few KB instead of scanning the audio.
+//
+// Level k summarises PEAK_BASE * PEAK_RATIO^k frames per entry and is
+// stored in <dir>/<prefix>.peaksK: a peak_file_header_t followed by
+// peak_entry_t entries, one per channel for each run of frames: entry
+// i * channels + c covers channel c of frames [i * decimation,
+// (i + 1) * decimation[.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef TESTAUDIO_PEAK_OVERVIEW_H
+#define TESTAUDIO_PEAK_OVERVIEW_H
+
+#define PEAK_LEVELS 3
+#define PEAK_BASE 256       // frames per entry of level 0
+#define PEAK_RATIO 8        // entries of level k per entry of level k + 1
+#define PEAK_MAX_CHANNELS 2
+
+#define PEAK_VERSION 2
+
+typedef struct peak_file_header {
+    char    id[4];          // "TAPK"
+    int32_t version;
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t level;
+    int32_t decimation;     // frames per entry
+} peak_file_header_t;
+
+typedef struct peak_entry {
+    int16_t min;
+    int16_t max;
+    int16_t rms;
+    int16_t reserved;
+} peak_entry_t;
+
+// running reduction over a run of samples
+typedef struct peak_accum {
+    int32_t min;
+    int32_t max;
+    int64_t sumsq;
+    int64_t count;
+} peak_accum_t;
+
+typedef struct peak_writer {
+    FILE *files[PEAK_LEVELS];
+    peak_accum_t acc[PEAK_LEVELS][PEAK_MAX_CHANNELS];
+    int  parts[PEAK_LEVELS];     // frames (level 0) or entries (above) in acc
+    int  channels;
+} peak_writer_t;
+
+
+void peak_accum_reset(peak_accum_t *a);
+void peak_reduce(const int16_t *samples, int n, peak_accum_t *a);
+
+peak_writer_t *peak_writer_open(const char *dir, const char *prefix, int sample_rate, int channels);
+void peak_writer_add(peak_writer_t *w, const short *samples, int frames);
+void peak_writer_close(peak_writer_t *w);
+
+int peak_overview_generate(const char *wav_path, const char *dir, const char *prefix);
+
+#endif //TESTAUDIO_PEAK_OVERVIEW_H
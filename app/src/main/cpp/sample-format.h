@@ -0,0 +1,57 @@
+//
+// Sample types carried between android_AudioIn, the processing code
+// and android_AudioOut. OpenSL always runs in 16 bit PCM, the traits
+// below convert to and from that format.
+//
+
+#include <stdint.h>
+
+#ifndef TESTAUDIO_SAMPLE_FORMAT_H
+#define TESTAUDIO_SAMPLE_FORMAT_H
+
+#define CONV16BIT 32768
+#define CONVMYFLT (1./32768.)
+
+// gains are passed to sample_traits<T>::mul as Q16 fixed point
+#define GAIN_UNITY 65536
+
+template <typename T> struct sample_traits;
+
+// 16 bit PCM, the device format: no conversion at all
+template <> struct sample_traits<int16_t> {
+    static const bool native = true;
+    static inline int16_t from16(int16_t s) { return s; }
+    static inline int16_t to16(int16_t s) { return s; }
+    static inline int16_t mul(int16_t s, int32_t g) {
+        int32_t v = (int32_t) (((int64_t) s * g) >> 16);
+        return (int16_t) (v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+    }
+};
+
+// Q1.31 fixed point, for integer processing with 16 bits of extra precision
+template <> struct sample_traits<int32_t> {
+    static const bool native = false;
+    static inline int32_t from16(int16_t s) { return (int32_t) s * 65536; }
+    static inline int16_t to16(int32_t s) {
+        int64_t v = (int64_t) s >> 16;
+        return (int16_t) (v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+    }
+    static inline int32_t mul(int32_t s, int32_t g) {
+        int64_t v = ((int64_t) s * g) >> 16;
+        return (int32_t) (v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v));
+    }
+};
+
+// float in [-1, 1[, saturated on the way out since gains go up to
+// CONTROL_MAX_GAIN
+template <> struct sample_traits<float> {
+    static const bool native = false;
+    static inline float from16(int16_t s) { return (float) ((float) s * CONVMYFLT); }
+    static inline int16_t to16(float s) {
+        float v = s * CONV16BIT;
+        return (int16_t) (v > 32767.f ? 32767 : (v < -32768.f ? -32768 : v));
+    }
+    static inline float mul(float s, int32_t g) { return s * ((float) g * (1.f / GAIN_UNITY)); }
+};
+
+#endif //TESTAUDIO_SAMPLE_FORMAT_H
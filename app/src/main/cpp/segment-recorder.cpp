@@ -0,0 +1,351 @@
+//
+// Segmented recording with a seek index
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "segment-recorder.h"
+#include "wav-file.h"
+
+
+// returns 0, or -1 if the path does not fit in size bytes
+int segment_path(char *path, size_t size, const char *dir, const char *prefix, int segment) {
+    int n = snprintf(path, size, "%s/%s-%05d.wav", dir, prefix, segment);
+    return n < 0 || (size_t) n >= size ? -1 : 0;
+}
+
+
+static int segment_part_path(char *path, size_t size, segment_recorder_t *r, int segment) {
+    int n = snprintf(path, size, "%s/%s-%05d.wav.part", r->dir, r->prefix, segment);
+    return n < 0 || (size_t) n >= size ? -1 : 0;
+}
+
+
+// create the .part of a segment, with a placeholder header
+static mmap_writer_t *segment_prepare(segment_recorder_t *r, int segment) {
+    char path[PATH_MAX];
+    struct wavfile header;
+    mmap_writer_t *file;
+
+    if (segment_part_path(path, sizeof(path), r, segment) != 0 ||
+        (file = mmap_writer_open(path)) == NULL)
+        return NULL;
+
+    wav_header_init(&header, r->sample_rate, (short) r->channels, 0);
+    mmap_writer_write(file, &header, sizeof(header));
+    return file;
+}
+
+
+// close a prepared segment that got no data, and remove it
+static void segment_discard(segment_recorder_t *r, mmap_writer_t *file, int segment) {
+    char part[PATH_MAX];
+
+    mmap_writer_close(file);
+    if (segment_part_path(part, sizeof(part), r, segment) == 0)
+        remove(part);
+}
+
+
+/*
+ * Complete a segment: final header, rename to its final name, then add
+ * it to the index. Readers never see a partial segment under its final
+ * name. Called by the worker, or by segment_recorder_close once it is
+ * gone.
+ */
+static int segment_finish(segment_recorder_t *r, const segment_job_t *job) {
+    char part[PATH_MAX], path[PATH_MAX];
+    struct wavfile header;
+    segment_index_entry_t entry;
+    int result = 0;
+
+    wav_header_init(&header, r->sample_rate, (short) r->channels, job->frames);
+    if (mmap_writer_pwrite(job->file, 0, &header, sizeof(header)) != 0)
+        result = -1;
+    if (mmap_writer_close(job->file) != 0)
+        result = -1;
+
+    if (result == 0 && (segment_part_path(part, sizeof(part), r, job->segment) != 0 ||
+                        segment_path(path, sizeof(path), r->dir, r->prefix, job->segment) != 0 ||
+                        rename(part, path) != 0))
+        result = -1;
+
+    if (result == 0) {
+        memset(&entry, 0, sizeof(entry));
+        entry.first_frame = job->first_frame;
+        entry.segment = job->segment;
+        entry.data_offset = (int32_t) sizeof(struct wavfile);
+        entry.frames = (int32_t) job->frames;
+        fwrite(&entry, sizeof(entry), 1, r->index);
+        fflush(r->index);
+    }
+    return result;
+}
+
+
+/*
+ * Worker thread: complete the segments handed over by the writer, and
+ * keep the next one prepared. Segments are prepared in order and a
+ * number is only used up once its file exists, so the writer, which
+ * counts the segments it takes, numbers them the same way.
+ */
+static void *segment_worker(void *arg) {
+    segment_recorder_t *r = (segment_recorder_t *) arg;
+    segment_job_t job;
+    mmap_writer_t *file;
+
+    for (;;) {
+        sem_wait(&r->wake);
+
+        while (r->jobs.pop(job))
+            segment_finish(r, &job);
+
+        if (r->quit.load())
+            break;
+
+        if (r->next.load(std::memory_order_acquire) == NULL &&
+            (file = segment_prepare(r, r->next_segment)) != NULL) {
+            r->next_segment++;
+            r->next.store(file, std::memory_order_release);
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Open a segmented recording of 16 bit interleaved samples. Segments are
+ * segment_seconds long, at most as long as a WAV file allows. The prefix
+ * must be new in dir: an existing recording is never overwritten.
+ * Returns NULL if the index file cannot be created or already exists, or
+ * the worker thread started.
+ */
+segment_recorder_t *segment_recorder_open(const char *dir, const char *prefix,
+                                          int sample_rate, int channels,
+                                          double segment_seconds) {
+    segment_recorder_t *r;
+    segment_index_header_t header;
+    char path[PATH_MAX];
+    double max_frames;
+    int n, fd;
+
+    if (channels < 1)
+        return NULL;
+
+    r = (segment_recorder_t *) calloc(sizeof(segment_recorder_t), (size_t) 1);
+    if (r == NULL)
+        return NULL;
+
+    snprintf(r->dir, sizeof(r->dir), "%s", dir);
+    snprintf(r->prefix, sizeof(r->prefix), "%s", prefix);
+    r->sample_rate = sample_rate;
+    r->channels = channels;
+
+    // the data size of a segment has to fit in the 32 bit fields of its header
+    max_frames = (double) (INT32_MAX - sizeof(struct wavfile)) / (sizeof(short) * channels);
+    if (segment_seconds * sample_rate > max_frames)
+        segment_seconds = max_frames / sample_rate;
+    r->segment_frames = (long) (segment_seconds * sample_rate);
+    if (r->segment_frames <= 0)
+        r->segment_frames = sample_rate;
+
+    n = snprintf(path, sizeof(path), "%s/%s.idx", r->dir, r->prefix);
+    if (n < 0 || (size_t) n >= sizeof(path) ||
+        (fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
+        free(r);
+        return NULL;
+    }
+    if ((r->index = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        remove(path);
+        free(r);
+        return NULL;
+    }
+
+    memcpy(header.id, "SIDX", 4);
+    header.sample_rate = sample_rate;
+    header.channels = channels;
+    header.segment_frames = (int32_t) r->segment_frames;
+    fwrite(&header, sizeof(header), 1, r->index);
+    fflush(r->index);
+
+    r->peaks = peak_writer_open(r->dir, r->prefix, sample_rate, channels);
+
+    // the first segment is ready before the first write if it can be
+    // created, the worker prepares the following ones, or retries it
+    r->quit.store(0);
+    r->segment = -1;
+    r->next_segment = 0;
+    r->next.store(segment_prepare(r, 0));
+    if (r->next.load() != NULL)
+        r->next_segment = 1;
+
+    if (sem_init(&r->wake, 0, 0) != 0)
+        goto open_error;
+    if (pthread_create(&r->worker, (const pthread_attr_t *) NULL, segment_worker, r) != 0) {
+        sem_destroy(&r->wake);
+        goto open_error;
+    }
+    return r;
+
+    open_error:
+    if (r->next.load() != NULL)
+        segment_discard(r, r->next.load(), 0);
+    peak_writer_close(r->peaks);
+    fclose(r->index);
+    free(r);
+    return NULL;
+}
+
+
+/*
+ * Hand the full segment being written to the worker.
+ * Returns 0, or -1 if the worker has too many of them already.
+ */
+static int segment_rotate(segment_recorder_t *r) {
+    segment_job_t job;
+
+    job.file = r->file;
+    job.segment = r->segment;
+    job.frames = r->frames_in_segment;
+    job.first_frame = r->total_frames - r->frames_in_segment;
+    if (!r->jobs.push(job))
+        return -1;
+
+    r->file = NULL;
+    sem_post(&r->wake);
+    return 0;
+}
+
+
+/*
+ * Start writing the segment prepared by the worker, and have it prepare
+ * the following one.
+ * Returns 0, or -1 if it is not ready.
+ */
+static int segment_take(segment_recorder_t *r) {
+    mmap_writer_t *file = r->next.exchange(NULL, std::memory_order_acq_rel);
+
+    sem_post(&r->wake);
+    if (file == NULL)
+        return -1;
+
+    // prepared in order, without gaps
+    r->file = file;
+    r->segment++;
+    r->frames_in_segment = 0;
+    return 0;
+}
+
+
+/*
+ * Append frames frames to the recording, rotating segments as they fill.
+ * Frames that find no segment ready are dropped, rather than waiting for
+ * the file system on the audio thread.
+ * Returns the number of frames written.
+ */
+int segment_recorder_write(segment_recorder_t *r, const short *samples, int frames) {
+    int n, written = 0;
+
+    if (r->peaks != NULL)
+        peak_writer_add(r->peaks, samples, frames);
+
+    while (written < frames) {
+        if (r->file != NULL && r->frames_in_segment == r->segment_frames &&
+            segment_rotate(r) != 0)
+            break;
+        if (r->file == NULL && segment_take(r) != 0)
+            break;
+
+        n = frames - written;
+        if (n > r->segment_frames - r->frames_in_segment)
+            n = (int) (r->segment_frames - r->frames_in_segment);
+
+        if (mmap_writer_write(r->file, samples + written * r->channels,
+                              sizeof(short) * r->channels * (size_t) n) != 0)
+            break;
+
+        written += n;
+        r->frames_in_segment += n;
+        r->total_frames += n;
+    }
+
+    r->dropped += frames - written;
+    return written;
+}
+
+
+// stop the worker, complete the last segment and close the recording
+void segment_recorder_close(segment_recorder_t *r) {
+    segment_job_t job;
+    mmap_writer_t *next;
+
+    if (r == NULL)
+        return;
+
+    // the worker completes the segments handed over before it exits
+    r->quit.store(1);
+    sem_post(&r->wake);
+    pthread_join(r->worker, (void **) NULL);
+    sem_destroy(&r->wake);
+
+    if (r->file != NULL && r->frames_in_segment > 0) {
+        job.file = r->file;
+        job.segment = r->segment;
+        job.frames = r->frames_in_segment;
+        job.first_frame = r->total_frames - r->frames_in_segment;
+        segment_finish(r, &job);
+    } else if (r->file != NULL) {
+        segment_discard(r, r->file, r->segment);
+    }
+
+    if ((next = r->next.load()) != NULL)
+        segment_discard(r, next, r->next_segment - 1);
+
+    peak_writer_close(r->peaks);
+    fclose(r->index);
+    free(r);
+}
+
+
+/*
+ * Find the segment and byte offset of a time position, in seconds, from
+ * the index file of a recording. All segments but the last have the same
+ * length, so this reads a single index entry.
+ * Returns 0, or -1 if the position is beyond the completed segments.
+ */
+int segment_index_seek(const char *index_path, double seconds, segment_position_t *pos) {
+    segment_index_header_t header;
+    segment_index_entry_t entry;
+    int64_t frame;
+    long k;
+    int result = -1;
+    FILE *f;
+
+    if ((f = fopen(index_path, "rb")) == NULL)
+        return -1;
+
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.id, "SIDX", 4) != 0
+        || header.segment_frames <= 0 || seconds < 0.)
+        goto seek_end;
+
+    frame = (int64_t) (seconds * header.sample_rate);
+    k = (long) (frame / header.segment_frames);
+
+    if (fseek(f, (long) sizeof(header) + k * (long) sizeof(entry), SEEK_SET) != 0
+        || fread(&entry, sizeof(entry), 1, f) != 1)
+        goto seek_end;
+
+    if (frame >= entry.first_frame + entry.frames)
+        goto seek_end;
+
+    pos->segment = entry.segment;
+    pos->offset = entry.data_offset + (long) (frame - entry.first_frame) * header.channels * (long) sizeof(short);
+    result = 0;
+
+    seek_end:
+    fclose(f);
+    return result;
+}
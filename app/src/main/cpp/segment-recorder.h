@@ -0,0 +1,98 @@
+//
+// Recording to fixed duration WAV segments, with an index file that maps
+// a time position to a segment and a byte offset in O(1).
+//
+// Segments are written to <dir>/<prefix>-NNNNN.wav.part and renamed to
+// <dir>/<prefix>-NNNNN.wav once complete, so a crash loses at most the
+// segment being written. The index <dir>/<prefix>.idx gets one entry per
+// completed segment, and the waveform overview of the whole recording
+// goes to <dir>/<prefix>.peaksK (see peak-overview.h).
+//
+// The writer, on the audio thread, never opens nor closes a file: a worker
+// thread creates the .part of the next segment ahead of time, and takes
+// over the completed ones to write their header, rename and index them.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include "control-params.h"
+#include "mmap-file.h"
+#include "peak-overview.h"
+
+#ifndef TESTAUDIO_SEGMENT_RECORDER_H
+#define TESTAUDIO_SEGMENT_RECORDER_H
+
+#define SEGMENT_PREFIX_MAX 64
+
+// completed segments that can wait for the worker, a power of 2
+#define SEGMENT_JOBS 8
+
+typedef struct segment_index_header {
+    char    id[4];           // "SIDX"
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t segment_frames;  // frames in every segment but the last
+} segment_index_header_t;
+
+typedef struct segment_index_entry {
+    int64_t first_frame;     // position of the segment in the recording
+    int32_t segment;         // segment number, NNNNN in the file name
+    int32_t data_offset;     // byte offset of the first sample in the file
+    int32_t frames;          // frames in the segment
+    int32_t reserved;
+} segment_index_entry_t;
+
+// a completed segment, handed to the worker
+typedef struct segment_job {
+    mmap_writer_t *file;
+    int     segment;
+    long    frames;
+    int64_t first_frame;
+} segment_job_t;
+
+typedef struct segment_recorder {
+    char dir[PATH_MAX];
+    char prefix[SEGMENT_PREFIX_MAX];
+    int  sample_rate;
+    int  channels;
+    long segment_frames;
+
+    // writer (audio thread) side
+    mmap_writer_t *file;     // segment being written, NULL between segments
+    peak_writer_t *peaks;
+    int  segment;            // number of file, or of the last one
+    long frames_in_segment;
+    int64_t total_frames;
+    int64_t dropped;         // frames lost while no segment was ready
+
+    // worker side
+    pthread_t worker;
+    sem_t wake;
+    std::atomic<int> quit;
+    FILE *index;
+    spsc_queue<segment_job_t, SEGMENT_JOBS> jobs;
+    std::atomic<mmap_writer_t *> next;  // segment prepared ahead, or NULL
+    int  next_segment;                  // number of the next one to prepare, for the worker only
+} segment_recorder_t;
+
+// position of a time in a segmented recording
+typedef struct segment_position {
+    int  segment;
+    long offset;             // byte offset in the segment file
+} segment_position_t;
+
+
+segment_recorder_t *segment_recorder_open(const char *dir, const char *prefix,
+                                          int sample_rate, int channels,
+                                          double segment_seconds);
+int segment_recorder_write(segment_recorder_t *r, const short *samples, int frames);
+void segment_recorder_close(segment_recorder_t *r);
+
+int segment_path(char *path, size_t size, const char *dir, const char *prefix, int segment);
+int segment_index_seek(const char *index_path, double seconds, segment_position_t *pos);
+
+#endif //TESTAUDIO_SEGMENT_RECORDER_H
@@ -0,0 +1,230 @@
+//
+// Shared memory export of the captured stream
+//
+
+#include <fcntl.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __ANDROID__
+#include <linux/ashmem.h>
+#endif
+#include "shm-export.h"
+
+#define SHM_EXPORT_NAME "testaudio-export"
+
+
+// an anonymous shared memory file of size bytes: memfd if the kernel has it, ashmem otherwise
+static int shm_create(const char *name, size_t size) {
+    int fd = -1;
+
+#ifdef __NR_memfd_create
+    fd = (int) syscall(__NR_memfd_create, name, 0);
+    if (fd >= 0 && ftruncate(fd, (off_t) size) != 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+
+#ifdef __ANDROID__
+    if (fd < 0 && (fd = open("/dev/ashmem", O_RDWR)) >= 0) {
+        if (ioctl(fd, ASHMEM_SET_NAME, name) < 0 || ioctl(fd, ASHMEM_SET_SIZE, size) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+#endif
+
+    return fd;
+}
+
+
+/*
+ * Create the shared ring for a stream of channels channels, written in
+ * blocks of at most block_frames frames.
+ * Returns NULL if the shared memory cannot be created.
+ */
+shm_export_t *shm_export_open(int sample_rate, int channels, int block_frames) {
+    shm_export_t *e;
+    shm_export_header_t *h;
+    size_t data_offset = (sizeof(shm_export_header_t) + 63) & ~(size_t) 63;
+    void *m;
+
+    e = (shm_export_t *) calloc(sizeof(shm_export_t), (size_t) 1);
+    if (e == NULL)
+        return NULL;
+
+    e->size = data_offset + (size_t) SHM_EXPORT_FRAMES * channels * sizeof(short);
+
+    if ((e->fd = shm_create(SHM_EXPORT_NAME, e->size)) < 0) {
+        free(e);
+        return NULL;
+    }
+
+    m = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, e->fd, 0);
+    if (m == MAP_FAILED) {
+        close(e->fd);
+        free(e);
+        return NULL;
+    }
+
+    h = new(m) shm_export_header_t;
+    memcpy(h->magic, "TASX", 4);
+    h->version = SHM_EXPORT_VERSION;
+    h->sample_rate = (uint32_t) sample_rate;
+    h->channels = (uint32_t) channels;
+    h->bytes_per_sample = sizeof(short);
+    h->capacity_frames = SHM_EXPORT_FRAMES;
+    h->block_frames = (uint32_t) block_frames;
+    h->data_offset = (uint32_t) data_offset;
+    h->write_sequence.store(0, std::memory_order_relaxed);
+    h->write_position.store(0, std::memory_order_relaxed);
+    h->active.store(1, std::memory_order_release);
+
+    e->header = h;
+    e->ring = (short *) ((char *) m + data_offset);
+    return e;
+}
+
+
+/*
+ * Publish frames frames. Never blocks: readers that fall more than the
+ * ring capacity behind lose the overwritten frames.
+ */
+void shm_export_write(shm_export_t *e, const short *samples, int frames) {
+    shm_export_header_t *h = e->header;
+    uint32_t pos = h->write_position.load(std::memory_order_relaxed);
+    uint32_t seq = h->write_sequence.load(std::memory_order_relaxed);
+    int channels = (int) h->channels, n, first;
+
+    while (frames > 0) {
+        n = frames < (int) h->block_frames ? frames : (int) h->block_frames;
+
+        // odd sequence: the oldest block_frames frames are being overwritten
+        h->write_sequence.store(++seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        first = (int) (SHM_EXPORT_FRAMES - (pos & (SHM_EXPORT_FRAMES - 1)));
+        if (first > n) first = n;
+        memcpy(e->ring + (pos & (SHM_EXPORT_FRAMES - 1)) * channels, samples,
+               (size_t) first * channels * sizeof(short));
+        memcpy(e->ring, samples + first * channels, (size_t) (n - first) * channels * sizeof(short));
+
+        pos += (uint32_t) n;
+        h->write_position.store(pos, std::memory_order_release);
+        h->write_sequence.store(++seq, std::memory_order_release);
+
+        samples += n * channels;
+        frames -= n;
+    }
+}
+
+
+// mark the stream as stopped and release the ring; mapped readers keep their copy of the memory
+void shm_export_close(shm_export_t *e) {
+    if (e == NULL)
+        return;
+
+    e->header->active.store(0, std::memory_order_release);
+    munmap(e->header, e->size);
+    close(e->fd);
+    free(e);
+}
+
+
+/*
+ * Map the ring behind fd for reading, starting at the current write
+ * position. Returns 0, or -1 if fd is not an export ring.
+ */
+int shm_reader_open(shm_reader_t *r, int fd) {
+    struct stat st;
+    const shm_export_header_t *h;
+    void *m;
+
+    memset(r, 0, sizeof(shm_reader_t));
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shm_export_header_t))
+        return -1;
+
+    m = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+        return -1;
+
+    h = (const shm_export_header_t *) m;
+    if (memcmp(h->magic, "TASX", 4) != 0 || h->version != SHM_EXPORT_VERSION
+        || h->data_offset + (size_t) h->capacity_frames * h->channels * sizeof(short) > (size_t) st.st_size) {
+        munmap(m, (size_t) st.st_size);
+        return -1;
+    }
+
+    r->size = (size_t) st.st_size;
+    r->header = h;
+    r->ring = (const short *) ((const char *) m + h->data_offset);
+    r->position = h->write_position.load(std::memory_order_acquire);
+    return 0;
+}
+
+
+/*
+ * Copy up to frames frames that were written since the last read.
+ * *lost is set to the number of frames the writer overwrote before they
+ * could be read; reading then resumes at the oldest valid frame.
+ * Returns the number of frames copied.
+ */
+int shm_reader_read(shm_reader_t *r, short *samples, int frames, uint32_t *lost) {
+    const shm_export_header_t *h = r->header;
+    uint32_t capacity = h->capacity_frames, mask = capacity - 1;
+    uint32_t pos, avail, oldest, seq, skipped;
+    int channels = (int) h->channels, n, first;
+
+    *lost = 0;
+
+    pos = h->write_position.load(std::memory_order_acquire);
+    avail = pos - r->position;
+    if (avail > capacity) {
+        *lost += avail - capacity;
+        r->position = pos - capacity;
+        avail = capacity;
+    }
+
+    n = avail < (uint32_t) frames ? (int) avail : frames;
+
+    first = (int) (capacity - (r->position & mask));
+    if (first > n) first = n;
+    memcpy(samples, r->ring + (r->position & mask) * channels, (size_t) first * channels * sizeof(short));
+    memcpy(samples + first * channels, r->ring, (size_t) (n - first) * channels * sizeof(short));
+
+    // anything older than what the writer may have touched meanwhile is
+    // invalid. The sequence is loaded first, with acquire: the position
+    // that follows is then at least the one published before it, so an
+    // odd sequence always comes with the start of the block being written
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq = h->write_sequence.load(std::memory_order_acquire);
+    pos = h->write_position.load(std::memory_order_relaxed);
+    oldest = pos + ((seq & 1) ? h->block_frames : 0) - capacity;
+
+    if ((int32_t) (oldest - r->position) > 0) {
+        skipped = oldest - r->position;
+        *lost += skipped;
+        r->position = oldest;
+        if (skipped >= (uint32_t) n)
+            return 0;
+        memmove(samples, samples + skipped * channels, (size_t) (n - skipped) * channels * sizeof(short));
+        n -= (int) skipped;
+    }
+
+    r->position += (uint32_t) n;
+    return n;
+}
+
+
+void shm_reader_close(shm_reader_t *r) {
+    if (r->header != NULL)
+        munmap((void *) r->header, r->size);
+    memset(r, 0, sizeof(shm_reader_t));
+}
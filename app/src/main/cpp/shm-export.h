@@ -0,0 +1,62 @@
+//
+// Live export of the captured stream to other processes, through a
+// shared memory ring (memfd, or ashmem where memfd is not available).
+//
+// The capture thread is the only writer and never waits for readers.
+// Readers map the same memory, follow write_position and detect that
+// the writer lapped them with write_sequence, which is odd while a block
+// is being written.
+//
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TESTAUDIO_SHM_EXPORT_H
+#define TESTAUDIO_SHM_EXPORT_H
+
+// ring capacity in frames, a power of 2 (about 3 s at 44.1 kHz)
+#define SHM_EXPORT_FRAMES (1 << 17)
+
+#define SHM_EXPORT_VERSION 1
+
+typedef struct shm_export_header {
+    char     magic[4];            // "TASX"
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t bytes_per_sample;    // 2, 16 bit PCM
+    uint32_t capacity_frames;     // SHM_EXPORT_FRAMES
+    uint32_t block_frames;        // the writer publishes at most this many frames at once
+    uint32_t data_offset;         // bytes from the start of the mapping to the ring
+    std::atomic<uint32_t> active;          // 0 once the stream has stopped
+    std::atomic<uint32_t> write_sequence;  // blocks written, odd while writing one
+    std::atomic<uint32_t> write_position;  // frames written, wraps around
+} shm_export_header_t;
+
+typedef struct shm_export {
+    int    fd;
+    size_t size;
+    shm_export_header_t *header;
+    short  *ring;
+} shm_export_t;
+
+typedef struct shm_reader {
+    size_t size;
+    const shm_export_header_t *header;
+    const short *ring;
+    uint32_t position;            // next frame to read
+} shm_reader_t;
+
+
+// capture side
+shm_export_t *shm_export_open(int sample_rate, int channels, int block_frames);
+void shm_export_write(shm_export_t *e, const short *samples, int frames);
+void shm_export_close(shm_export_t *e);
+
+// reader side, in any process that received the descriptor
+int shm_reader_open(shm_reader_t *r, int fd);
+int shm_reader_read(shm_reader_t *r, short *samples, int frames, uint32_t *lost);
+void shm_reader_close(shm_reader_t *r);
+
+#endif //TESTAUDIO_SHM_EXPORT_H
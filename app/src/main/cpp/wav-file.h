@@ -0,0 +1,43 @@
+//
+// 16 bit PCM WAV files
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TESTAUDIO_WAV_FILE_H
+#define TESTAUDIO_WAV_FILE_H
+
+struct wavfile
+{
+    char        id[4];          // should always contain "RIFF"
+    int     totallength;    // total file length minus 8
+    char        wavefmt[8];     // should be "WAVEfmt "
+    int     format;         // 16 for PCM format
+    short     pcm;            // 1 for PCM format
+    short     channels;       // channels
+    int     frequency;      // sampling frequency, 16000 in this case
+    int     bytes_per_second;
+    short     bytes_by_capture;
+    short     bits_per_sample;
+    char        data[4];        // should always contain "data"
+    int     bytes_in_data;
+};
+
+// a 16 bit PCM WAV file mapped in memory, read without any copy
+typedef struct wav_map {
+    void        *base;
+    size_t      size;
+    const short *samples;       // interleaved, points into the mapping
+    long        frames;
+    int         channels;
+    int         sample_rate;
+} wav_map_t;
+
+// fill in the header of a 16 bit PCM file of frames frames
+void wav_header_init(struct wavfile *h, int sample_rate, short channels, long frames);
+
+int wav_map_open(const char *path, wav_map_t *m);
+void wav_map_close(wav_map_t *m);
+
+#endif //TESTAUDIO_WAV_FILE_H
@@ -1,11 +1,16 @@
 package com.example.alex.testaudio
 
 import android.os.Bundle
+import android.os.Handler
 import android.support.v7.app.AppCompatActivity
+import android.widget.SeekBar
 import android.widget.Toast
 import kotlinx.android.synthetic.main.content_main.*
 import android.bluetooth.BluetoothAdapter
 import android.os.Build
+import java.text.SimpleDateFormat
+import java.util.Date
+import java.util.Locale
 
 
 class MainActivity : AppCompatActivity() {
@@ -13,6 +18,28 @@ class MainActivity : AppCompatActivity() {
 	lateinit var thread: Thread
 	var is_recording = false
 
+	// native handles, see openengine and opensession
+	var engine = 0L
+	var session = 0L
+
+	val handler = Handler()
+
+	// refreshes the dsp load display while recording
+	val load_updater = object : Runnable {
+		override fun run() {
+			// total cpu load: average, p99, max (see getload), the clock drift
+			// and the concealed output frames
+			val load = getload(session)
+			dspload.text = getString(R.string.dsp_load,
+				Math.round(load[LOAD_TOTAL * 6] * 100),
+				Math.round(load[LOAD_TOTAL * 6 + 1] * 100),
+				Math.round(load[LOAD_TOTAL * 6 + 2] * 100),
+				getdrift(session),
+				getjitter(session)[1])
+			handler.postDelayed(this, LOAD_REFRESH_MS)
+		}
+	}
+
 	override fun onCreate(savedInstanceState: Bundle?) {
 		super.onCreate(savedInstanceState)
 		setContentView(R.layout.activity_main)
@@ -23,6 +50,29 @@ class MainActivity : AppCompatActivity() {
 		btn_stop.setOnClickListener { stop_recording() }
 		vumeter.progress = 100
 
+		gain.setOnSeekBarChangeListener(object : SeekBar.OnSeekBarChangeListener {
+			override fun onProgressChanged(seekBar: SeekBar, progress: Int, fromUser: Boolean) {
+				// programmatic changes (restored state) apply at once
+				setgain(session, progress / 100f, !fromUser)
+			}
+			override fun onStartTrackingTouch(seekBar: SeekBar) {}
+			override fun onStopTrackingTouch(seekBar: SeekBar) {}
+		})
+		btn_mute.setOnCheckedChangeListener { _, checked -> setmute(session, checked) }
+		btn_monitor.setOnCheckedChangeListener { _, checked -> setmonitor(session, checked) }
+
+		engine = openengine()
+		if (engine != 0L)
+			session = opensession(engine, SAMPLE_RATE, IN_CHANNELS, OUT_CHANNELS)
+
+		if (session != 0L) {
+			setsmoothing(session, SMOOTHING_MS)
+		} else {
+			// no audio: nothing to start, the native calls ignore the 0 handle
+			btn_record.isEnabled = false
+			Toast.makeText(this, "audio engine unavailable", Toast.LENGTH_LONG).show()
+		}
+
 		init()
 	}
 
@@ -49,32 +99,51 @@ class MainActivity : AppCompatActivity() {
 	override fun onDestroy() {
 		if (is_recording)
 			stop_recording()
+		if (session != 0L)
+			closesession(session)
+		if (engine != 0L)
+			closeengine(engine)
+		session = 0L
+		engine = 0L
 		super.onDestroy()
 	}
 
 
 	private fun start_recording() {
 
+		if (session == 0L || is_recording)
+			return
+
 		val toast = Toast.makeText(this, "recording started", Toast.LENGTH_SHORT)
 		toast.show()
 
+		// a new prefix each time, the recorder does not overwrite an existing one
+		val prefix = RECORD_PREFIX + "-" + SimpleDateFormat(RECORD_TIME_FORMAT, Locale.US).format(Date())
+		setrecording(session, RECORD_DIR, prefix, SEGMENT_SECONDS)
+
+		armprocess(session)
 		thread = object : Thread() {
 			override fun run() {
 				priority = Thread.MAX_PRIORITY
-				startprocess()
+				startprocess(session)
 			}
 		}
 		thread.start()
 		is_recording = true
+		handler.postDelayed(load_updater, LOAD_REFRESH_MS)
 
 	}
 
 
 	private fun stop_recording() {
+		if (!is_recording)
+			return
+
 		val toast = Toast.makeText(this, "recording stopped", Toast.LENGTH_SHORT)
 		toast.show()
 
-		stopprocess()
+		handler.removeCallbacks(load_updater)
+		stopprocess(session)
 		is_recording = false
 		try {
 			thread.join()
@@ -89,6 +158,26 @@ class MainActivity : AppCompatActivity() {
 
 	companion object {
 
+		const val LOAD_TOTAL = 3
+		const val LOAD_REFRESH_MS = 250L
+
+		// the monitoring stream: mono capture played in stereo, at the
+		// engine rate as it has outputs
+		const val SAMPLE_RATE = 44100
+		const val IN_CHANNELS = 1
+		const val OUT_CHANNELS = 2
+
+		// gain, mute and monitor changes are smoothed over about this time
+		const val SMOOTHING_MS = 20f
+
+		// recording goes to RECORD_DIR/RECORD_PREFIX-<start time>-NNNNN.wav,
+		// SEGMENT_SECONDS each, with the seek index in
+		// RECORD_DIR/RECORD_PREFIX-<start time>.idx
+		const val RECORD_DIR = "/sdcard"
+		const val RECORD_PREFIX = "rawFile"
+		const val RECORD_TIME_FORMAT = "yyyyMMdd-HHmmss"
+		const val SEGMENT_SECONDS = 60f
+
 		// Used to load the 'native-lib' library on application startup.
 		init {
 			System.loadLibrary("native-lib")
@@ -101,7 +190,52 @@ class MainActivity : AppCompatActivity() {
 	 * native methods implemented by the 'native-lib' native library
 	 */
 
-	external fun startprocess()
-	external fun stopprocess()
+	// one engine per process, shared by any number of sessions (each a
+	// capture to playback, capture only or playback only stream, with 0
+	// channels on the missing side; outputs are mixed together). A 0
+	// handle means it could not be opened, and is ignored by the calls below
+	external fun openengine(): Long
+	external fun closeengine(engine: Long)
+	external fun opensession(engine: Long, sampleRate: Int, inChannels: Int, outChannels: Int): Long
+	external fun closesession(session: Long)
+
+	// armprocess before starting the thread that runs startprocess, so that
+	// a stopprocess coming while it opens the stream is not lost
+	external fun armprocess(session: Long)
+	external fun startprocess(session: Long)
+	external fun stopprocess(session: Long)
+
+	// control parameters, safe to call while processing runs
+	external fun setgain(session: Long, gain: Float, snap: Boolean)
+	external fun setmute(session: Long, mute: Boolean)
+	external fun setmonitor(session: Long, monitor: Boolean)
+	external fun setsmoothing(session: Long, ms: Float)
+
+	// recording location and segment length, used by the next startprocess
+	external fun setrecording(session: Long, dir: String, prefix: String, segmentSeconds: Float)
+
+	// 16 bit wav at the session rate that a playback only session plays in a loop,
+	// e.g. a cue track, used by the next startprocess
+	external fun setsource(session: Long, path: String)
+
+	// waveform overview dir/prefix.peaksN of an existing wav, as written while recording
+	external fun makepeaks(wav: String, dir: String, prefix: String): Boolean
+
+	// live export of the captured stream to other processes, used by the next startprocess;
+	// getexportfd returns the shared memory descriptor while recording, -1 otherwise
+	external fun setexport(session: Long, enabled: Boolean)
+	external fun getexportfd(session: Long): Int
+
+	// dsp load per stage (capture, process, playback, total):
+	// cpu avg, p99, max, then wall avg, p99, max, as fractions of the period
+	external fun getload(session: Long): FloatArray
+
+	// drift of the capture clock against the playback clock, in ppm
+	external fun getdrift(session: Long): Float
+
+	// output buffering in blocks (1.5 to 3.5), used by the next startprocess;
+	// getjitter returns the underruns, concealed frames and realigned frames
+	external fun setjitter(session: Long, blocks: Float)
+	external fun getjitter(session: Long): IntArray
 
 }
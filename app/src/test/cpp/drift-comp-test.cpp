@@ -0,0 +1,130 @@
+//
+// Drift compensation against mismatched capture and playback clocks.
+//
+// Simulates the monitor loop of android_AudioThroughDrift: capture
+// blocks arrive on a clock off by a few hundred ppm, late by a random
+// part of a period, and player buffers are consumed on the nominal
+// clock. Once settled, the estimate must match the offset, the latency
+// must sit at the target and the player must never run dry.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "drift-comp.h"
+
+#define TEST_RATE 44100.
+#define TEST_FRAMES 1024
+#define TEST_MINUTES 20
+
+// checked over the last minutes only, and underruns after the first ones
+#define TEST_CHECK_MINUTES 5
+#define TEST_SETTLE_MINUTES 2
+
+typedef struct player {
+    uint32_t queued;        // buffers enqueued
+    uint32_t taken;         // taken by the mixer
+    uint32_t played;        // played out
+    double   played_at;     // time the last one ended
+    long     underruns;
+} player_t;
+
+
+static unsigned lcg = 12345;
+
+static double uniform(void) {
+    lcg = lcg * 1103515245u + 12345u;
+    return (lcg >> 8) / 16777216.;
+}
+
+
+// period boundary of the player at time t
+static void player_period(player_t *pl, double t) {
+    if (pl->taken > pl->played) {
+        pl->played++;
+        pl->played_at = t;
+    }
+    if (pl->queued > pl->taken)
+        pl->taken++;
+    else if (pl->played > 0)
+        pl->underruns++;
+}
+
+
+// same as openSLOutputPending
+static double player_pending(const player_t *pl, double t) {
+    uint32_t queued = pl->queued - pl->played;
+    double head = 0.;
+
+    if (queued > 0) {
+        head = (t - pl->played_at) * TEST_RATE;
+        if (head > TEST_FRAMES) head = TEST_FRAMES;
+    }
+    return (double) queued * TEST_FRAMES - head;
+}
+
+
+// 0 if the compensation holds a capture clock off by ppm
+static int simulate(double ppm, double jitter) {
+    static short in[TEST_FRAMES];
+    drift_comp_t d;
+    player_t pl = {0, 0, 0, 0., 0};
+    double in_period = TEST_FRAMES / (TEST_RATE * (1. + ppm * 1e-6));
+    double out_period = TEST_FRAMES / TEST_RATE;
+    double t, next_out = .3 * out_period, end = TEST_MINUTES * 60.;
+    double check = end - TEST_CHECK_MINUTES * 60., settle = TEST_SETTLE_MINUTES * 60.;
+    double latency, sum = 0., worst = 0.;
+    long k, n = 0, underruns = 0;
+
+    if (drift_init(&d, 1, TEST_FRAMES, DRIFT_TARGET_BLOCKS) != 0)
+        return -1;
+
+    for (k = 1; (t = k * in_period + jitter * uniform() * in_period) < end; k++) {
+        while (next_out <= t) {
+            player_period(&pl, next_out);
+            next_out += out_period;
+        }
+        if (t < settle)
+            underruns = pl.underruns;
+
+        // android_AudioThroughDrift
+        drift_resample(&d, in, TEST_FRAMES);
+        while (pl.queued - pl.played < (uint32_t) d.target_blocks && d.fifo_fill >= TEST_FRAMES) {
+            drift_fifo_drop(&d, TEST_FRAMES);
+            if (pl.queued == pl.played)
+                pl.played_at = t;
+            pl.queued++;
+        }
+        latency = d.fifo_fill + player_pending(&pl, t);
+        drift_update(&d, latency);
+
+        if (t >= check) {
+            sum += latency;
+            n++;
+            if (fabs(d.ppm - ppm) > worst)
+                worst = fabs(d.ppm - ppm);
+        }
+    }
+    drift_free(&d);
+
+    underruns = pl.underruns - underruns;
+    latency = sum / n / TEST_FRAMES;
+    printf("%+6.0f ppm, jitter %.2f: estimate off by %4.1f ppm at most, "
+           "latency %.2f blocks, %ld underruns\n", ppm, jitter, worst, latency, underruns);
+
+    return worst < 10. && fabs(latency - DRIFT_TARGET_BLOCKS) < .25 && underruns == 0 ? 0 : -1;
+}
+
+
+int main(void) {
+    static const double ppms[] = {-800., -300., -50., 0., 50., 300., 800.};
+    int i, result = 0;
+
+    for (i = 0; i < (int) (sizeof(ppms) / sizeof(ppms[0])); i++) {
+        if (simulate(ppms[i], 0.) != 0)
+            result = 1;
+        if (simulate(ppms[i], .5) != 0)
+            result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,332 @@
+//
+// Mixer of the player streams, driven one period at a time.
+//
+// A stream that stalls and then delivers everything at once must be
+// concealed and realigned back to its depth, without a click. Inputs of
+// either layout must sum with saturation, buffers that do not match the
+// period must come out whole and in order, and a removed input must no
+// longer be mixed nor called back.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "audio-mixer.h"
+
+#define TEST_RATE 44100
+#define TEST_PERIOD 256
+
+// stall then burst: a sine of TEST_AMPLITUDE at TEST_FREQUENCY, in
+// buffers of one period, TEST_DEPTH of them kept queued; the producer
+// holds back TEST_STALL of them, then hands them all over at once
+#define TEST_AMPLITUDE 8000.
+#define TEST_FREQUENCY 441.
+#define TEST_DEPTH 2
+#define TEST_STALL 3
+#define TEST_PERIODS 40
+
+// the largest sample step allowed, over the TEST_AMPLITUDE * 2 pi f / rate
+// of the sine itself (about 500), for the crossfades of the concealment
+#define TEST_MAX_STEP 1000
+
+// partial buffers: frames per buffer, not a divisor of the period
+#define TEST_PARTIAL 100
+
+// buffers a stream cycles through: all it can have queued, plus the
+// one being consumed, plus the ones held back
+#define TEST_RING 8
+
+
+typedef struct stream {
+    short buffers[TEST_RING][TEST_PERIOD * MIXER_CHANNELS];
+    int channels;
+    int frames;             // per buffer
+    long produced;          // buffers filled
+    long enqueued;
+    long done;              // called back by the mixer
+    long next_frame;        // of the generated signal
+} stream_t;
+
+
+static void stream_done(void *context) {
+    ((stream_t *) context)->done++;
+}
+
+
+static void stream_init(stream_t *st, int channels, int frames) {
+    st->channels = channels;
+    st->frames = frames;
+    st->produced = st->enqueued = st->done = 0;
+    st->next_frame = 0;
+}
+
+
+// frames in the input: what is left of the buffer being consumed and the queue
+static int input_pending(const mixer_input_t *in) {
+    return (in->current != NULL ? in->frames - in->offset : 0) +
+           (int) (in->queue.tail.load() - in->queue.head.load()) * in->frames;
+}
+
+
+// fill the next buffer with the sine, the same on all channels
+static void produce_sine(stream_t *st) {
+    short *b = st->buffers[st->produced % TEST_RING];
+    int i, c;
+
+    for (i = 0; i < st->frames; i++, st->next_frame++)
+        for (c = 0; c < st->channels; c++)
+            b[i * st->channels + c] = (short) (TEST_AMPLITUDE *
+                sin(2. * M_PI * TEST_FREQUENCY * st->next_frame / TEST_RATE));
+    st->produced++;
+}
+
+
+// fill the next buffer with a counter, negated on the second channel
+static void produce_ramp(stream_t *st) {
+    short *b = st->buffers[st->produced % TEST_RING];
+    int i;
+
+    for (i = 0; i < st->frames; i++, st->next_frame++) {
+        b[i * st->channels] = (short) (st->next_frame % 30000);
+        if (st->channels == MIXER_CHANNELS)
+            b[i * st->channels + 1] = (short) -(st->next_frame % 30000);
+    }
+    st->produced++;
+}
+
+
+// hand the produced buffers to the mixer, as many as fit
+static void stream_flush(stream_t *st, mixer_input_t *in) {
+    while (st->enqueued < st->produced &&
+           mixer_enqueue(in, st->buffers[st->enqueued % TEST_RING]) == 0)
+        st->enqueued++;
+}
+
+
+/*
+ * A stream that keeps TEST_DEPTH buffers queued, producing one per
+ * period, stalls for TEST_STALL periods and then hands over what it
+ * held back. The first of them drains the queue, the others are
+ * concealed, then as many late frames are dropped: the queue is back to
+ * its depth at the next period, and stays there.
+ */
+static int test_stall_burst(void) {
+    static audio_mixer_t m;
+    static stream_t st;
+    static short out[TEST_PERIODS * TEST_PERIOD * MIXER_CHANNELS];
+    mixer_stats_t stats;
+    mixer_input_t *in;
+    int t, i, c, step, max_step = 0, pending, failed = 0;
+    uint32_t concealed = (TEST_STALL - 1) * TEST_PERIOD;
+
+    stats.underruns = 0;
+    stats.concealed = 0;
+    stats.realigned = 0;
+
+    mixer_init(&m, TEST_PERIOD);
+    stream_init(&st, MIXER_CHANNELS, TEST_PERIOD);
+    in = mixer_add_input(&m, MIXER_CHANNELS, TEST_PERIOD, TEST_DEPTH * TEST_PERIOD,
+                         stream_done, &st, &stats);
+    if (in == NULL)
+        return 1;
+
+    for (i = 0; i < TEST_DEPTH - 1; i++)
+        produce_sine(&st);
+    stream_flush(&st, in);
+
+    for (t = 0; t < TEST_PERIODS; t++) {
+        produce_sine(&st);
+        if (t < 10 || t >= 10 + TEST_STALL)
+            stream_flush(&st, in);
+
+        // at its depth before each period, but during the stall and at the
+        // burst, which has to be realigned
+        pending = input_pending(in);
+        if ((t < 10 || t > 10 + TEST_STALL) && pending != TEST_DEPTH * TEST_PERIOD) {
+            printf("period %d: %d frames queued, %d expected\n", t, pending, TEST_DEPTH * TEST_PERIOD);
+            failed++;
+        }
+
+        mixer_run(&m, out + t * TEST_PERIOD * MIXER_CHANNELS);
+    }
+
+    for (i = 1; i < TEST_PERIODS * TEST_PERIOD; i++)
+        for (c = 0; c < MIXER_CHANNELS; c++) {
+            step = abs(out[i * MIXER_CHANNELS + c] - out[(i - 1) * MIXER_CHANNELS + c]);
+            if (step > max_step)
+                max_step = step;
+        }
+
+    printf("stall then burst: %u underruns, %u concealed, %u realigned, largest step %d\n",
+           stats.underruns.load(), stats.concealed.load(), stats.realigned.load(), max_step);
+
+    if (stats.underruns.load() != 1 || stats.concealed.load() != concealed ||
+        stats.realigned.load() != concealed || max_step > TEST_MAX_STEP)
+        failed++;
+
+    mixer_remove_input(&m, in);
+    return failed;
+}
+
+
+/*
+ * A stereo and a mono input, each at the edge of the range: the mono one
+ * goes to both channels, and the sums saturate.
+ */
+static int test_summing(void) {
+    static audio_mixer_t m;
+    static stream_t stereo, mono;
+    short out[TEST_PERIOD * MIXER_CHANNELS];
+    mixer_input_t *a, *b;
+    int i, expected, failed = 0;
+
+    mixer_init(&m, TEST_PERIOD);
+    stream_init(&stereo, MIXER_CHANNELS, TEST_PERIOD);
+    stream_init(&mono, 1, TEST_PERIOD);
+    a = mixer_add_input(&m, MIXER_CHANNELS, TEST_PERIOD, TEST_PERIOD, stream_done, &stereo, NULL);
+    b = mixer_add_input(&m, 1, TEST_PERIOD, TEST_PERIOD, stream_done, &mono, NULL);
+    if (a == NULL || b == NULL)
+        return 1;
+
+    for (i = 0; i < TEST_PERIOD; i++) {
+        stereo.buffers[0][2 * i] = 30000;
+        stereo.buffers[0][2 * i + 1] = -30000;
+        mono.buffers[0][i] = (short) (i & 1 ? -5000 : 5000);
+    }
+    stereo.produced = mono.produced = 1;
+    stream_flush(&stereo, a);
+    stream_flush(&mono, b);
+
+    mixer_run(&m, out);
+
+    for (i = 0; i < TEST_PERIOD; i++) {
+        expected = i & 1 ? 25000 : 32767;
+        if (out[2 * i] != expected)
+            failed++;
+        expected = i & 1 ? -32768 : -25000;
+        if (out[2 * i + 1] != expected)
+            failed++;
+    }
+
+    printf("summing: %d wrong samples, %ld + %ld buffers done\n", failed, stereo.done, mono.done);
+    if (stereo.done != 1 || mono.done != 1)
+        failed++;
+
+    mixer_remove_input(&m, a);
+    mixer_remove_input(&m, b);
+    return failed;
+}
+
+
+/*
+ * Buffers of TEST_PARTIAL frames against periods of TEST_PERIOD: each
+ * period takes the end of one buffer and the start of another, and the
+ * counter comes out without a frame lost or repeated.
+ */
+static int test_partial(int channels) {
+    static audio_mixer_t m;
+    static stream_t st;
+    short out[TEST_PERIOD * MIXER_CHANNELS];
+    mixer_stats_t stats;
+    mixer_input_t *in;
+    long frame = 0;
+    int t, i, failed = 0;
+
+    stats.underruns = 0;
+    stats.concealed = 0;
+    stats.realigned = 0;
+
+    mixer_init(&m, TEST_PERIOD);
+    stream_init(&st, channels, TEST_PARTIAL);
+    in = mixer_add_input(&m, channels, TEST_PARTIAL, 3 * TEST_PARTIAL, stream_done, &st, &stats);
+    if (in == NULL)
+        return 1;
+
+    for (t = 0; t < TEST_PERIODS; t++) {
+        while (st.produced - st.done < MIXER_QUEUE) {
+            produce_ramp(&st);
+            stream_flush(&st, in);
+        }
+
+        mixer_run(&m, out);
+
+        for (i = 0; i < TEST_PERIOD; i++, frame++)
+            if (out[2 * i] != (short) (frame % 30000) ||
+                out[2 * i + 1] != (short) (channels == 1 ? frame % 30000 : -(frame % 30000)))
+                failed++;
+    }
+
+    printf("partial buffers, %d channels: %d wrong frames, %ld buffers done, %u underruns\n",
+           channels, failed, st.done, stats.underruns.load());
+    if (st.done != frame / TEST_PARTIAL || stats.underruns.load() != 0)
+        failed++;
+
+    mixer_remove_input(&m, in);
+    return failed;
+}
+
+
+/*
+ * Of two inputs, remove one with buffers still queued: the next periods
+ * only hold the other one, the removed one is not called back anymore,
+ * and its slot can be taken again.
+ */
+static int test_removal(void) {
+    static audio_mixer_t m;
+    static stream_t kept, removed;
+    short out[TEST_PERIOD * MIXER_CHANNELS];
+    mixer_input_t *a, *b, *c;
+    long done, frame = 0;
+    int t, i, failed = 0;
+
+    mixer_init(&m, TEST_PERIOD);
+    stream_init(&kept, MIXER_CHANNELS, TEST_PERIOD);
+    stream_init(&removed, MIXER_CHANNELS, TEST_PERIOD);
+    a = mixer_add_input(&m, MIXER_CHANNELS, TEST_PERIOD, TEST_PERIOD, stream_done, &kept, NULL);
+    b = mixer_add_input(&m, MIXER_CHANNELS, TEST_PERIOD, TEST_PERIOD, stream_done, &removed, NULL);
+    if (a == NULL || b == NULL)
+        return 1;
+
+    for (i = 0; i < MIXER_QUEUE; i++) {
+        produce_ramp(&kept);
+        produce_sine(&removed);
+    }
+    stream_flush(&kept, a);
+    stream_flush(&removed, b);
+
+    mixer_run(&m, out);
+    frame += TEST_PERIOD;
+    mixer_remove_input(&m, b);
+    done = removed.done;
+
+    for (t = 1; t < MIXER_QUEUE; t++) {
+        mixer_run(&m, out);
+        for (i = 0; i < TEST_PERIOD; i++, frame++)
+            if (out[2 * i] != (short) (frame % 30000) || out[2 * i + 1] != (short) -(frame % 30000))
+                failed++;
+    }
+
+    c = mixer_add_input(&m, 1, TEST_PERIOD, TEST_PERIOD, stream_done, &removed, NULL);
+
+    printf("removal: %d wrong frames, %ld buffers done after it, slot %s\n",
+           failed, removed.done - done, c == b ? "taken again" : "lost");
+    if (done != 1 || removed.done != done || kept.done != MIXER_QUEUE || c != b)
+        failed++;
+
+    mixer_remove_input(&m, a);
+    mixer_remove_input(&m, c);
+    return failed;
+}
+
+
+int main(void) {
+    int failed = 0;
+
+    failed += test_stall_burst();
+    failed += test_summing();
+    failed += test_partial(1);
+    failed += test_partial(MIXER_CHANNELS);
+    failed += test_removal();
+
+    return failed != 0;
+}
@@ -0,0 +1,184 @@
+//
+// Memory mapped writer against stdio, writing a recording in capture
+// sized buffers: syscalls and throughput.
+//
+// Write syscalls are read from /proc/self/io, the mapping ones (mmap,
+// munmap, fallocate, ftruncate) are counted by the --wrap'ed functions
+// below. Fails if the two files differ, or if the writer makes more
+// syscalls than stdio.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap-file.h"
+
+// 16 bit stereo buffers of 1024 frames, about 6 min at 44.1 kHz
+#define BENCH_BUFFER 4096
+#define BENCH_BYTES (64L * 1024 * 1024)
+
+static long mapping_syscalls;
+
+extern "C" {
+void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int __real_munmap(void *addr, size_t length);
+int __real_fallocate(int fd, int mode, off_t offset, off_t len);
+int __real_ftruncate(int fd, off_t length);
+
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    mapping_syscalls++;
+    return __real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+int __wrap_munmap(void *addr, size_t length) {
+    mapping_syscalls++;
+    return __real_munmap(addr, length);
+}
+
+int __wrap_fallocate(int fd, int mode, off_t offset, off_t len) {
+    mapping_syscalls++;
+    return __real_fallocate(fd, mode, offset, len);
+}
+
+int __wrap_ftruncate(int fd, off_t length) {
+    mapping_syscalls++;
+    return __real_ftruncate(fd, length);
+}
+}
+
+
+// write syscalls made by the process so far, or -1 without task io accounting
+static long write_syscalls(void) {
+    char line[128];
+    long n = -1;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/io", "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "syscw: %ld", &n) == 1)
+            break;
+    fclose(f);
+    return n;
+}
+
+
+static double now(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+typedef struct bench_result {
+    long   syscalls;
+    double seconds;
+} bench_result_t;
+
+
+static int bench_mmap(const char *path, const char *buffer, bench_result_t *res) {
+    mmap_writer_t *w;
+    long writes = write_syscalls(), mapping = mapping_syscalls, k;
+    double t = now();
+
+    if ((w = mmap_writer_open(path)) == NULL)
+        return -1;
+    for (k = 0; k < BENCH_BYTES / BENCH_BUFFER; k++)
+        if (mmap_writer_write(w, buffer + (k % 16) * BENCH_BUFFER, BENCH_BUFFER) != 0)
+            return -1;
+    if (mmap_writer_close(w) != 0)
+        return -1;
+
+    res->seconds = now() - t;
+    res->syscalls = write_syscalls() - writes + mapping_syscalls - mapping;
+    return 0;
+}
+
+
+static int bench_stdio(const char *path, const char *buffer, bench_result_t *res) {
+    FILE *f;
+    long writes = write_syscalls(), k;
+    double t = now();
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return -1;
+    for (k = 0; k < BENCH_BYTES / BENCH_BUFFER; k++)
+        if (fwrite(buffer + (k % 16) * BENCH_BUFFER, BENCH_BUFFER, 1, f) != 1)
+            return -1;
+    if (fclose(f) != 0)
+        return -1;
+
+    res->seconds = now() - t;
+    res->syscalls = write_syscalls() - writes;
+    return 0;
+}
+
+
+// 0 if the files at a and b have the same contents
+static int compare(const char *a, const char *b) {
+    static char x[65536], y[65536];
+    size_t n, m;
+    int result = -1;
+    FILE *f = fopen(a, "rb"), *g = fopen(b, "rb");
+
+    if (f == NULL || g == NULL)
+        goto compare_end;
+
+    do {
+        n = fread(x, 1, sizeof(x), f);
+        m = fread(y, 1, sizeof(y), g);
+        if (n != m || memcmp(x, y, n) != 0)
+            goto compare_end;
+    } while (n > 0);
+    result = 0;
+
+    compare_end:
+    if (f != NULL) fclose(f);
+    if (g != NULL) fclose(g);
+    return result;
+}
+
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    char mmap_path[PATH_MAX], stdio_path[PATH_MAX];
+    static char buffer[16 * BENCH_BUFFER];
+    bench_result_t m, s;
+    int i, result = 1;
+
+    snprintf(mmap_path, sizeof(mmap_path), "%s/bench-mmap.raw", dir);
+    snprintf(stdio_path, sizeof(stdio_path), "%s/bench-stdio.raw", dir);
+
+    for (i = 0; i < (int) sizeof(buffer); i++)
+        buffer[i] = (char) (i * 31 + (i >> 8));
+
+    if (bench_mmap(mmap_path, buffer, &m) != 0 || bench_stdio(stdio_path, buffer, &s) != 0) {
+        fprintf(stderr, "write failed\n");
+        goto bench_end;
+    }
+
+    printf("%ld MB in %d byte buffers\n", BENCH_BYTES >> 20, BENCH_BUFFER);
+    printf("mmap writer: %6ld syscalls, %7.1f MB/s\n", m.syscalls, (BENCH_BYTES >> 20) / m.seconds);
+    printf("stdio:       %6ld syscalls, %7.1f MB/s\n", s.syscalls, (BENCH_BYTES >> 20) / s.seconds);
+
+    if (compare(mmap_path, stdio_path) != 0) {
+        fprintf(stderr, "the files differ\n");
+        goto bench_end;
+    }
+    if (write_syscalls() >= 0 && m.syscalls >= s.syscalls) {
+        fprintf(stderr, "the mmap writer makes more syscalls than stdio\n");
+        goto bench_end;
+    }
+    result = 0;
+
+    bench_end:
+    remove(mmap_path);
+    remove(stdio_path);
+    return result;
+}
@@ -0,0 +1,242 @@
+//
+// Segmented recording, written as the capture thread does, while the
+// worker rotates the segments.
+//
+// Every index entry must name the file holding the audio it locates, the
+// files must hold the frames accepted by segment_recorder_write in order,
+// and no .part file may be left behind. The first segment is also made
+// impossible to create at open time, then possible again, and impossible
+// for the whole recording.
+//
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "segment-recorder.h"
+#include "wav-file.h"
+
+#define TEST_RATE 8000
+#define TEST_CHANNELS 2
+#define TEST_BLOCK 200         // a divisor of TEST_TOTAL
+#define TEST_SECONDS 3
+#define TEST_SEGMENT_SECONDS .5
+
+#define TEST_TOTAL (TEST_RATE * TEST_SECONDS)
+
+// stereo frame at position pos of the input
+static inline short sample(long pos, int c) { return (short) (pos * 7 + c * 1000); }
+
+// input position of each frame accepted, in recording order
+static long accepted[TEST_TOTAL];
+
+
+static int exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+
+// .part files left in dir (the directory blocking a segment is not one)
+static int leftovers(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    struct stat st;
+    char path[PATH_MAX];
+    int n = 0;
+
+    if (d == NULL)
+        return 1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (len > 5 && strcmp(e->d_name + len - 5, ".part") == 0
+            && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            fprintf(stderr, "left behind: %s\n", e->d_name);
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+
+/*
+ * Record TEST_SECONDS of input in dir, calling between(r) after open.
+ * Returns the number of frames recorded, and sets *dropped.
+ */
+static long record(const char *dir, void (*between)(const char *dir), int64_t *dropped) {
+    segment_recorder_t *r;
+    short block[TEST_BLOCK * TEST_CHANNELS];
+    long pos, frames = 0;
+    int i, c, n;
+
+    if ((r = segment_recorder_open(dir, "rec", TEST_RATE, TEST_CHANNELS, TEST_SEGMENT_SECONDS)) == NULL)
+        return -1;
+    if (between != NULL)
+        between(dir);
+
+    for (pos = 0; pos < TEST_TOTAL; pos += TEST_BLOCK) {
+        for (i = 0; i < TEST_BLOCK; i++)
+            for (c = 0; c < TEST_CHANNELS; c++)
+                block[i * TEST_CHANNELS + c] = sample(pos + i, c);
+
+        n = segment_recorder_write(r, block, TEST_BLOCK);
+        for (i = 0; i < n; i++)
+            accepted[frames++] = pos + i;
+
+        usleep(1000);
+    }
+
+    *dropped = r->dropped;
+    segment_recorder_close(r);
+    return frames;
+}
+
+
+// 0 if the index and the segments of dir hold the frames recorded
+static int verify(const char *dir, long frames) {
+    segment_index_header_t header;
+    segment_index_entry_t entry;
+    wav_map_t m;
+    char path[PATH_MAX];
+    long k, i, total = 0;
+    int c, result = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/rec.idx", dir);
+    if ((f = fopen(path, "rb")) == NULL || fread(&header, sizeof(header), 1, f) != 1)
+        goto verify_end;
+
+    for (k = 0; fread(&entry, sizeof(entry), 1, f) == 1; k++) {
+        if (entry.segment != k || entry.first_frame != total
+            || (entry.frames != header.segment_frames && total + entry.frames != frames)) {
+            fprintf(stderr, "entry %ld: segment %d at %lld, %d frames\n", k, entry.segment,
+                    (long long) entry.first_frame, entry.frames);
+            goto verify_end;
+        }
+
+        segment_path(path, sizeof(path), dir, "rec", entry.segment);
+        if (wav_map_open(path, &m) != 0 || m.frames != entry.frames || m.channels != TEST_CHANNELS) {
+            fprintf(stderr, "segment %d: not a WAV file of %d frames\n", entry.segment, entry.frames);
+            goto verify_end;
+        }
+        for (i = 0; i < m.frames; i++) {
+            for (c = 0; c < TEST_CHANNELS; c++) {
+                if (m.samples[i * TEST_CHANNELS + c] != sample(accepted[total + i], c)) {
+                    fprintf(stderr, "segment %d: frame %ld is not the one recorded\n", entry.segment, i);
+                    wav_map_close(&m);
+                    goto verify_end;
+                }
+            }
+        }
+        wav_map_close(&m);
+        total += entry.frames;
+    }
+
+    if (total != frames) {
+        fprintf(stderr, "%ld frames indexed, %ld recorded\n", total, frames);
+        goto verify_end;
+    }
+    result = leftovers(dir) == 0 ? 0 : -1;
+
+    verify_end:
+    if (f != NULL) fclose(f);
+    return result;
+}
+
+
+// remove dir and the files in it
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char path[PATH_MAX];
+
+    if (d == NULL)
+        return;
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        remove(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+
+static void block_first(const char *dir) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/rec-00000.wav.part", dir);
+    mkdir(path, 0755);
+}
+
+
+static void unblock_first(const char *dir) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/rec-00000.wav.part", dir);
+    rmdir(path);
+}
+
+
+// a fresh directory under base
+static int make_dir(char *dir, size_t size, const char *base, const char *name) {
+    snprintf(dir, size, "%s/%s-XXXXXX", base, name);
+    return mkdtemp(dir) != NULL ? 0 : -1;
+}
+
+
+int main(int argc, char **argv) {
+    const char *base = argc > 1 ? argv[1] : ".";
+    char dir[PATH_MAX], path[PATH_MAX];
+    segment_recorder_t *r;
+    int64_t dropped;
+    long frames;
+    int failed = 0;
+
+    // plain recording: nothing dropped
+    if (make_dir(dir, sizeof(dir), base, "plain") != 0)
+        return 1;
+    frames = record(dir, NULL, &dropped);
+    printf("plain: %ld frames, %lld dropped\n", frames, (long long) dropped);
+    if (frames != TEST_TOTAL || dropped != 0 || verify(dir, frames) != 0)
+        failed++;
+
+    // the same prefix again: refused, the recording is left as it was
+    if ((r = segment_recorder_open(dir, "rec", TEST_RATE, TEST_CHANNELS, TEST_SEGMENT_SECONDS)) != NULL) {
+        printf("existing prefix: opened\n");
+        segment_recorder_close(r);
+        failed++;
+    }
+    if (verify(dir, frames) != 0)
+        failed++;
+    remove_dir(dir);
+
+    // the first segment cannot be created at open, then can
+    if (make_dir(dir, sizeof(dir), base, "late") != 0)
+        return 1;
+    block_first(dir);
+    frames = record(dir, unblock_first, &dropped);
+    printf("late first segment: %ld frames, %lld dropped\n", frames, (long long) dropped);
+    if (frames <= 0 || frames + dropped != TEST_TOTAL || verify(dir, frames) != 0)
+        failed++;
+    remove_dir(dir);
+
+    // it never can: nothing is recorded, the directory stays what it was
+    if (make_dir(dir, sizeof(dir), base, "blocked") != 0)
+        return 1;
+    block_first(dir);
+    frames = record(dir, NULL, &dropped);
+    printf("blocked first segment: %ld frames, %lld dropped\n", frames, (long long) dropped);
+    segment_path(path, sizeof(path), dir, "rec", 0);
+    if (frames != 0 || exists(path) || verify(dir, frames) != 0)
+        failed++;
+    remove_dir(dir);
+
+    return failed != 0;
+}
@@ -0,0 +1,128 @@
+//
+// Shared memory export read from a forked process, as another app would.
+//
+// The parent writes a stereo stream whose samples encode their position,
+// the child reads it, now and then too slowly, so that the writer laps
+// it. Every frame the reader returns must be the one at its position,
+// and the frames returned plus the ones reported lost must cover the
+// whole stream.
+//
+
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shm-export.h"
+
+#define TEST_RATE 44100
+#define TEST_BLOCK 1024
+#define TEST_FRAMES (64 * SHM_EXPORT_FRAMES)
+#define TEST_READ 512
+
+
+static inline short left(uint32_t pos) { return (short) (pos * 7u); }
+static inline short right(uint32_t pos) { return (short) ~(pos * 13u); }
+
+
+// child: read until the writer stops, 0 if all is well. A byte on ready
+// tells the parent it can start writing.
+static int reader(int fd, int ready) {
+    shm_reader_t r;
+    short samples[TEST_READ * 2];
+    uint32_t lost, total_lost = 0, start, i;
+    long reads = 0, frames = 0;
+    int n, idle;
+
+    if (shm_reader_open(&r, fd) != 0) {
+        fprintf(stderr, "reader: not an export ring\n");
+        return 1;
+    }
+    if (r.position != 0) {
+        fprintf(stderr, "reader: opened at %u\n", r.position);
+        return 1;
+    }
+    if (write(ready, "", 1) != 1)
+        return 1;
+
+    for (idle = 0;;) {
+        n = shm_reader_read(&r, samples, TEST_READ, &lost);
+        total_lost += lost;
+        start = r.position - (uint32_t) n;
+
+        for (i = 0; i < (uint32_t) n; i++) {
+            if (samples[2 * i] != left(start + i) || samples[2 * i + 1] != right(start + i)) {
+                fprintf(stderr, "reader: frame %u is torn\n", start + i);
+                return 1;
+            }
+        }
+        frames += n;
+
+        if (n == 0) {
+            // stopped, and nothing was left
+            if (!r.header->active.load(std::memory_order_acquire) && idle++ > 0)
+                break;
+            sched_yield();
+        } else {
+            idle = 0;
+        }
+
+        // fall behind now and then
+        if (++reads % 256 == 0)
+            usleep(20000);
+    }
+
+    printf("reader: %ld frames read, %u lost\n", frames, total_lost);
+    fflush(stdout);
+    if (frames + total_lost != TEST_FRAMES || r.position != TEST_FRAMES) {
+        fprintf(stderr, "reader: %ld + %u frames, %u expected\n", frames, total_lost, TEST_FRAMES);
+        return 1;
+    }
+    if (total_lost == 0) {
+        fprintf(stderr, "reader: never lapped\n");
+        return 1;
+    }
+
+    shm_reader_close(&r);
+    return 0;
+}
+
+
+int main(void) {
+    shm_export_t *e;
+    short samples[TEST_BLOCK * 2];
+    uint32_t pos, i;
+    pid_t pid;
+    int status, ready[2];
+    char c;
+
+    if ((e = shm_export_open(TEST_RATE, 2, TEST_BLOCK)) == NULL) {
+        fprintf(stderr, "cannot create the ring\n");
+        return 1;
+    }
+
+    if (pipe(ready) != 0 || (pid = fork()) < 0)
+        return 1;
+    if (pid == 0)
+        _exit(reader(e->fd, ready[1]));
+    if (read(ready[0], &c, 1) != 1) {
+        waitpid(pid, &status, 0);
+        return 1;
+    }
+
+    for (pos = 0; pos < TEST_FRAMES; pos += TEST_BLOCK) {
+        for (i = 0; i < TEST_BLOCK; i++) {
+            samples[2 * i] = left(pos + i);
+            samples[2 * i + 1] = right(pos + i);
+        }
+        shm_export_write(e, samples, TEST_BLOCK);
+
+        // about 20 times real time
+        if ((pos / TEST_BLOCK) % 16 == 0)
+            usleep(1000);
+    }
+    shm_export_close(e);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return 1;
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,112 @@
+//
+// WAV reader against well formed and hostile files.
+//
+// wav_map_open backs makepeaks, which takes any existing file: chunk
+// sizes that would wrap the walk or run past the mapping must be
+// rejected, not followed. Run with a timeout, a wrapped walk never ends.
+//
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include "wav-file.h"
+
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) (v >> 16);
+    p[3] = (unsigned char) (v >> 24);
+}
+
+
+static int write_file(const char *path, const void *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL)
+        return -1;
+    if (fwrite(data, 1, size, f) != size) {
+        fclose(f);
+        return -1;
+    }
+    return fclose(f);
+}
+
+
+/*
+ * 64 byte file: RIFF header, a 16 bit stereo fmt chunk, then a chunk
+ * named id of size size, and zeros up to the end.
+ */
+static size_t hostile(unsigned char *b, const char *id, uint32_t size) {
+    struct wavfile h;
+
+    memset(b, 0, 64);
+    wav_header_init(&h, 44100, 2, 0);
+    memcpy(b, &h, 36);                  // up to the end of the fmt chunk
+    put_le32(b + 4, 56);
+    memcpy(b + 36, id, 4);
+    put_le32(b + 40, size);
+    return 64;
+}
+
+
+// 0 if wav_map_open of path returns expect and, when it opens, frames frames
+static int check(const char *name, const char *path, int expect, long frames) {
+    wav_map_t m;
+    int result = wav_map_open(path, &m);
+
+    if (result != expect || (result == 0 && m.frames != frames)) {
+        fprintf(stderr, "%s: returned %d with %ld frames\n", name, result, m.frames);
+        wav_map_close(&m);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    wav_map_close(&m);
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    static const uint32_t sizes[] = {0xFFFFFFF7u, 0xFFFFFFF8u, 0xFFFFFFFFu, 0x7FFFFFF0u, 0x80000000u};
+    unsigned char b[64 + 400];
+    char path[PATH_MAX], name[64];
+    struct wavfile h;
+    size_t n;
+    int i, failed = 0;
+
+    snprintf(path, sizeof(path), "%s/wav-file-test.wav", dir);
+
+    // complete file, 100 stereo frames
+    memset(b, 0, sizeof(b));
+    wav_header_init(&h, 44100, 2, 100);
+    memcpy(b, &h, sizeof(h));
+    if (write_file(path, b, sizeof(h) + 400) != 0)
+        return 1;
+    failed += check("complete", path, 0, 100);
+
+    // never finalised: 0 data size, the frames are counted from the file size
+    wav_header_init(&h, 44100, 2, 0);
+    memcpy(b, &h, sizeof(h));
+    if (write_file(path, b, sizeof(h) + 400) != 0)
+        return 1;
+    failed += check("unfinalised", path, 0, 100);
+
+    // chunks that claim more than the file holds, wrapping sizes included
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+        n = hostile(b, "LIST", sizes[i]);
+        if (write_file(path, b, n) != 0)
+            return 1;
+        snprintf(name, sizeof(name), "LIST of 0x%08x bytes", sizes[i]);
+        failed += check(name, path, -1, 0);
+    }
+
+    // odd sized last chunk, its pad byte missing
+    n = hostile(b, "LIST", 19);
+    if (write_file(path, b, n) != 0)
+        return 1;
+    failed += check("odd last chunk", path, -1, 0);
+
+    remove(path);
+    return failed != 0;
+}